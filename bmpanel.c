@@ -200,6 +200,7 @@ static void reload_config_and_theme()
 	/* free theme */
 	free_config_format_tree(&theme);
 	reconfigure_free_panel(&p, &ws);
+	clean_image_cache(0);
 
 	/* reload */
 	if (load_theme(&theme, theme_override) < 0)
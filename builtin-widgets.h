@@ -21,10 +21,16 @@ struct taskbar_task {
 	int desktop;
 	int x;
 	int w;
-	int geom_x; /* for _NET_WM_ICON_GEOMETRY */
-	int geom_w;
+	long geom[4]; /* last published _NET_WM_ICON_GEOMETRY */
+	int geom_dirty;
 	int demands_attention;
 	int monitor; /* for multihead setups */
+	int pending; /* geometry and icon aren't fetched yet */
+
+	/* pre-rendered task (see draw_task), NULL if invalid */
+	cairo_surface_t *cache;
+	int cache_w;
+	int cache_state;
 
 	/* I'm using only one name source Atom and I'm watching it for
 	 * updates.
@@ -48,6 +54,13 @@ struct taskbar_theme {
 	cairo_surface_t *separator;
 };
 
+/* position of a visible task (see layout_tasks) */
+struct taskbar_slot {
+	int task; /* index in "tasks" */
+	int x;
+	int w;
+};
+
 struct taskbar_widget {
 	struct taskbar_theme theme;
 
@@ -55,6 +68,14 @@ struct taskbar_widget {
 	struct taskbar_task *tasks;
 	size_t tasks_n;
 	size_t tasks_alloc;
+	GHashTable *tasks_index; /* Window -> index in "tasks" + 1 */
+
+	/* visible tasks in drawing order, sorted by "x" */
+	struct taskbar_slot *slots;
+	size_t slots_n;
+	size_t slots_alloc;
+	int layout_dirty;
+	int layout_key[5]; /* geometry the layout was done for */
 
 	Window active;
 	int highlighted;
@@ -86,6 +107,13 @@ struct clock_theme {
 struct clock_widget {
 	struct clock_theme theme;
 
+	/* the most often changing time unit of time_format in seconds, 0 if
+	 * the text never changes (see format_time_unit)
+	 */
+	int unit;
+	char widest_digit;
+	char lasttime[128];
+
 	/* parameters from bmpanel2rc */
 	char *clock_prog;
 	int mouse_button;
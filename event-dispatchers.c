@@ -1,11 +1,99 @@
 #include "gui.h"
+#include "array.h"
 
-static inline int point_in_rect(int px, int py, int x, int y, int w, int h)
+/* Widgets are laid out left to right, so their regions make one sorted
+ * list and the pointer lookup is a binary search instead of asking every
+ * widget. Gaps inside a widget (between its items) are regions without an
+ * item, only separators and empty space between widgets have no region.
+ */
+static void append_hot_region(struct panel *p, struct widget *w,
+			      int x, int x2, long item)
 {
-	return (px >= x &&
-		px < x + w &&
-		py >= y &&
-		py < y + h);
+	if (x2 <= x)
+		return;
+
+	struct hot_region r = {x, x2 - x, w, item};
+	ARRAY_APPEND(p->hot_regions, r);
+}
+
+/* end of the last region of the widget "w", or its left edge */
+static int hot_regions_end(struct panel *p, struct widget *w)
+{
+	if (p->hot_regions_n) {
+		struct hot_region *last = &p->hot_regions[p->hot_regions_n - 1];
+		if (last->widget == w)
+			return last->x + last->width;
+	}
+	return w->x;
+}
+
+void add_hot_region(struct widget *w, int x, int width, long item)
+{
+	struct panel *p = w->panel;
+	int end = hot_regions_end(p, w);
+	int x2 = MININT(x + width, w->x + w->width);
+
+	/* overlapping or unordered parts are clipped */
+	x = MAXINT(x, end);
+	append_hot_region(p, w, end, x, -1);
+	append_hot_region(p, w, x, x2, item);
+}
+
+static void build_hot_regions(struct panel *p)
+{
+	size_t i;
+
+	CLEAR_ARRAY(p->hot_regions);
+	for (i = 0; i < p->widgets_n; ++i) {
+		struct widget *w = &p->widgets[i];
+		if (!w->width)
+			continue;
+		if (w->interface->hot_regions)
+			(*w->interface->hot_regions)(w);
+		append_hot_region(p, w, hot_regions_end(p, w),
+				  w->x + w->width, -1);
+	}
+	p->hot_regions_dirty = 0;
+}
+
+struct hot_region *panel_hot_region_at(struct panel *p, int x)
+{
+	if (p->hot_regions_dirty)
+		build_hot_regions(p);
+
+	/* last region starting at or before "x" */
+	size_t lo = 0, hi = p->hot_regions_n;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (p->hot_regions[mid].x <= x)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (!lo)
+		return 0;
+
+	struct hot_region *r = &p->hot_regions[lo - 1];
+	if (x >= r->x + r->width)
+		return 0;
+	return r;
+}
+
+long widget_item_at(struct widget *w, int x)
+{
+	struct hot_region *r = panel_hot_region_at(w->panel, x);
+	if (!r || r->widget != w)
+		return -1;
+	return r->item;
+}
+
+static struct widget *widget_at(struct panel *p, int x, int y)
+{
+	if (y < 0 || y >= p->height)
+		return 0;
+
+	struct hot_region *r = panel_hot_region_at(p, x);
+	return r ? r->widget : 0;
 }
 
 void disp_button_press_release(struct panel *p, XButtonEvent *e)
@@ -17,29 +105,25 @@ void disp_button_press_release(struct panel *p, XButtonEvent *e)
 		p->last_button = 0;
 	}
 
-	size_t i;
-	for (i = 0; i < p->widgets_n; ++i) {
-		struct widget *w = &p->widgets[i];
-		if (point_in_rect(e->x, e->y, w->x, 0, w->width, p->height)) {
-			if (!p->dnd.taken_on) {
-				if (e->type == ButtonPress) {
-					p->last_click_widget = w;
-					p->last_click_x = e->x;
-					p->last_click_y = e->y;
-					p->last_button = e->button;
-				}
-				if (w->interface->button_click)
-					(*w->interface->button_click)(w, e);
-			} else {
-				if (e->type == ButtonRelease) {
-					p->dnd.dropped_on = w;
-					p->dnd.dropped_x = e->x;
-					p->dnd.dropped_y = e->y;
-					if (w->interface->dnd_drop)
-						(*w->interface->dnd_drop)(w, &p->dnd);
-				}
+	struct widget *w = widget_at(p, e->x, e->y);
+	if (w) {
+		if (!p->dnd.taken_on) {
+			if (e->type == ButtonPress) {
+				p->last_click_widget = w;
+				p->last_click_x = e->x;
+				p->last_click_y = e->y;
+				p->last_button = e->button;
+			}
+			if (w->interface->button_click)
+				(*w->interface->button_click)(w, e);
+		} else {
+			if (e->type == ButtonRelease) {
+				p->dnd.dropped_on = w;
+				p->dnd.dropped_x = e->x;
+				p->dnd.dropped_y = e->y;
+				if (w->interface->dnd_drop)
+					(*w->interface->dnd_drop)(w, &p->dnd);
 			}
-			break;
 		}
 	}
 	if (e->type == ButtonRelease && p->dnd.taken_on) {
@@ -53,34 +137,27 @@ void disp_button_press_release(struct panel *p, XButtonEvent *e)
 
 void disp_motion_notify(struct panel *p, XMotionEvent *e)
 {
-	size_t i;
-
 	/* is there any widget under mouse at all? for example if mouse is on
 	   top of separator, there is no widget under it */
-	int widget_under_mouse = 0;
+	struct widget *w = widget_at(p, e->x, e->y);
 
 	/* motion events: enter, leave, motion */
-	for (i = 0; i < p->widgets_n; ++i) {
-		struct widget *w = &p->widgets[i];
-		if (point_in_rect(e->x, e->y, w->x, 0, w->width, p->height)) {
-			if (w == p->under_mouse) {
-				if (w->interface->mouse_motion)
-					(*w->interface->mouse_motion)(w, e);
-			} else {
-				if (p->under_mouse &&
-				    p->under_mouse->interface->mouse_leave)
-				{
-					(*p->under_mouse->interface->
-						mouse_leave)(p->under_mouse);
-				}
-				p->under_mouse = w;
-				if (w->interface->mouse_enter)
-					(*w->interface->mouse_enter)(w);
+	if (w) {
+		if (w == p->under_mouse) {
+			if (w->interface->mouse_motion)
+				(*w->interface->mouse_motion)(w, e);
+		} else {
+			if (p->under_mouse &&
+			    p->under_mouse->interface->mouse_leave)
+			{
+				(*p->under_mouse->interface->
+					mouse_leave)(p->under_mouse);
 			}
-			widget_under_mouse = 1;
+			p->under_mouse = w;
+			if (w->interface->mouse_enter)
+				(*w->interface->mouse_enter)(w);
 		}
-	}
-	if (!widget_under_mouse) {
+	} else {
 		if (p->under_mouse && p->under_mouse->interface->mouse_leave)
 			(*p->under_mouse->interface->mouse_leave)(p->under_mouse);
 		p->under_mouse = 0;
@@ -130,22 +207,107 @@ void disp_enter_leave_notify(struct panel *p, XCrossingEvent *e)
 	}
 }
 
-void disp_property_notify(struct panel *p, XPropertyEvent *e)
+/* Widgets' routing lists are gathered into one table, so property changes
+ * and client messages nobody is interested in are dropped with a single
+ * lookup instead of calling every widget. Widget masks are "unsigned int",
+ * PANEL_MAX_WIDGETS must fit.
+ */
+static void free_event_route(gpointer data)
+{
+	xfree(data);
+}
+
+static struct event_route *get_event_route(struct panel *p, Atom atom)
+{
+	struct event_route *r = g_hash_table_lookup(p->event_routes,
+						     GUINT_TO_POINTER(atom));
+	if (!r) {
+		r = xmallocz(sizeof(struct event_route));
+		g_hash_table_insert(p->event_routes, GUINT_TO_POINTER(atom), r);
+	}
+	return r;
+}
+
+static void add_routes(struct panel *p, const int *atoms, int kind,
+		       unsigned int bit)
+{
+	Atom *xatoms = p->connection.atoms;
+	for (; *atoms != -1; ++atoms)
+		get_event_route(p, xatoms[*atoms])->masks[kind] |= bit;
+}
+
+void build_event_routes(struct panel *p)
 {
+	free_event_routes(p);
+	p->event_routes = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+						0, free_event_route);
+
 	size_t i;
 	for (i = 0; i < p->widgets_n; ++i) {
+		struct widget_interface *wi = p->widgets[i].interface;
+		unsigned int bit = 1u << i;
+
+		if (wi->prop_change) {
+			if (!wi->root_props && !wi->window_props) {
+				p->route_all.masks[ROUTE_ROOT_PROPS] |= bit;
+				p->route_all.masks[ROUTE_WINDOW_PROPS] |= bit;
+			}
+			if (wi->root_props)
+				add_routes(p, wi->root_props, ROUTE_ROOT_PROPS, bit);
+			if (wi->window_props)
+				add_routes(p, wi->window_props, ROUTE_WINDOW_PROPS, bit);
+		}
+
+		if (wi->client_msg) {
+			if (wi->client_msgs)
+				add_routes(p, wi->client_msgs, ROUTE_CLIENT_MSGS, bit);
+			else
+				p->route_all.masks[ROUTE_CLIENT_MSGS] |= bit;
+		}
+	}
+}
+
+void free_event_routes(struct panel *p)
+{
+	if (p->event_routes) {
+		g_hash_table_destroy(p->event_routes);
+		p->event_routes = 0;
+	}
+	CLEAR_STRUCT(&p->route_all);
+}
+
+static unsigned int lookup_route(struct panel *p, Atom atom, int kind)
+{
+	unsigned int mask = p->route_all.masks[kind];
+	struct event_route *r = g_hash_table_lookup(p->event_routes,
+						    GUINT_TO_POINTER(atom));
+	if (r)
+		mask |= r->masks[kind];
+	return mask;
+}
+
+void disp_property_notify(struct panel *p, XPropertyEvent *e)
+{
+	int kind = e->window == p->connection.root ?
+		ROUTE_ROOT_PROPS : ROUTE_WINDOW_PROPS;
+	unsigned int mask = lookup_route(p, e->atom, kind);
+
+	size_t i;
+	for (i = 0; mask; ++i, mask >>= 1) {
 		struct widget *w = &p->widgets[i];
-		if (w->interface->prop_change)
+		if (mask & 1)
 			(*w->interface->prop_change)(w, e);
 	}
 }
 
 void disp_client_msg(struct panel *p, XClientMessageEvent *e)
 {
+	unsigned int mask = lookup_route(p, e->message_type, ROUTE_CLIENT_MSGS);
+
 	size_t i;
-	for (i = 0; i < p->widgets_n; ++i) {
+	for (i = 0; mask; ++i, mask >>= 1) {
 		struct widget *w = &p->widgets[i];
-		if (w->interface->client_msg)
+		if (mask & 1)
 			(*w->interface->client_msg)(w, e);
 	}
 }
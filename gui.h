@@ -78,7 +78,7 @@ struct widget_interface {
 	void (*destroy_widget_private)(struct widget *w);
 	void (*draw)(struct widget *w);
 	void (*button_click)(struct widget *w, XButtonEvent *e);
-	void (*clock_tick)(struct widget *w); /* every second */
+	void (*clock_tick)(struct widget *w); /* see widget_set_deadline */
 	void (*prop_change)(struct widget *w, XPropertyEvent *e);
 	void (*mouse_enter)(struct widget *w);
 	void (*mouse_leave)(struct widget *w);
@@ -87,6 +87,21 @@ struct widget_interface {
 	void (*client_msg)(struct widget *w, XClientMessageEvent *e);
 	void (*win_destroy)(struct widget *w, XDestroyWindowEvent *e);
 
+	/* Event routing (see build_event_routes). Lists of XATOM_* indices
+	 * terminated by -1: properties of the root window and of other windows
+	 * delivered to "prop_change", message types delivered to "client_msg".
+	 * A widget without lists gets all events of that kind.
+	 */
+	const int *root_props;
+	const int *window_props;
+	const int *client_msgs;
+
+	/* Reports item areas for pointer hit-testing with add_hot_region, in
+	 * increasing x order (see build_hot_regions). A widget without it is
+	 * one region with no item.
+	 */
+	void (*hot_regions)(struct widget *w);
+
 	void (*dnd_start)(struct widget *w, struct drag_info *di);
 	void (*dnd_drag)(struct widget *w, struct drag_info *di);
 	void (*dnd_drop)(struct widget *w, struct drag_info *di);
@@ -107,6 +122,7 @@ struct widget {
 
 	int needs_expose;
 	int no_separator;
+	gint64 deadline; /* g_get_real_time() of the next clock_tick, 0 - none */
 	int paint_replace; /* for transparent render */
 
 	void *private; /* private part */
@@ -143,6 +159,33 @@ struct panel_theme {
 };
 
 #define PANEL_MAX_WIDGETS 20
+#define PANEL_MAX_DAMAGE 32
+
+/* damaged part of a widget, spans the whole panel height */
+struct damage_span {
+	struct widget *widget;
+	int x;
+	int width;
+};
+
+#define ROUTE_ROOT_PROPS 0
+#define ROUTE_WINDOW_PROPS 1
+#define ROUTE_CLIENT_MSGS 2
+
+/* masks of widgets (bit N is widgets[N]) interested in an atom */
+struct event_route {
+	unsigned int masks[3]; /* ROUTE_* */
+};
+
+/* Part of the panel under the pointer, "item" is widget-defined (-1 if
+ * there is no item).
+ */
+struct hot_region {
+	int x;
+	int width;
+	struct widget *widget;
+	long item;
+};
 
 struct render_interface;
 
@@ -162,6 +205,11 @@ struct panel {
 	PangoLayout *layout;
 	GMainLoop *loop;
 
+	/* tiled background with separators, built on demand after widgets
+	 * are positioned (see recalculate_widgets_sizes)
+	 */
+	cairo_surface_t *bg_layer;
+
 	/* panel dimensions */
 	int x;
 	int y;
@@ -175,9 +223,37 @@ struct panel {
 	/* expose flag */
 	int needs_expose;
 
+	/* damaged regions reported by widgets (see widget_damage) */
+	struct damage_span damage[PANEL_MAX_DAMAGE];
+	size_t damage_n;
+
+	/* frame scheduling (see schedule_frame) */
+	guint frame_source;
+	int frame_interval; /* ms, 0 means expose immediately */
+	int frame_coalesce_input;
+
+	/* the only timer, armed for the earliest widget deadline */
+	guint timer_source;
+	gint64 timer_deadline;
+
+	/* pointer motion waiting for the next frame (see dispatch_motion) */
+	XMotionEvent motion;
+	int motion_pending;
+
 	/* event dispatching state */
 	int drag_threshold;
 
+	GHashTable *event_routes; /* Atom -> struct event_route */
+	struct event_route route_all; /* widgets without routing lists */
+
+	/* hit-test index sorted by x, rebuilt on demand after widgets were
+	 * redrawn (see panel_hot_region_at)
+	 */
+	struct hot_region *hot_regions;
+	size_t hot_regions_n;
+	size_t hot_regions_alloc;
+	int hot_regions_dirty;
+
 	struct widget *under_mouse;
 	struct drag_info dnd;
 
@@ -197,6 +273,9 @@ struct panel {
 struct render_interface {
 	const char *name;
 
+	/* panel window and p->bg use 32 bit ARGB visual */
+	int argb;
+
 	/* creates private render data (called after create_win) */
 	void (*create_private)(struct panel *p);
 	void (*free_private)(struct panel *p);
@@ -219,6 +298,7 @@ struct render_interface {
 
 extern struct render_interface render_normal;
 extern struct render_interface render_pseudo;
+extern struct render_interface render_composite;
 
 void init_panel(struct panel *panel, struct config_format_tree *tree,
 		int monitor);
@@ -231,9 +311,16 @@ void reconfigure_widgets(struct panel *panel);
 void panel_main_loop(struct panel *panel);
 
 void recalculate_widgets_sizes(struct panel *panel);
+void widget_damage(struct widget *w, int x, int width);
+void widget_set_deadline(struct widget *w, gint64 deadline);
 int check_mbutton_condition(struct panel *panel, int mbutton, unsigned int condition);
 
 /* event dispatchers */
+void build_event_routes(struct panel *p);
+void free_event_routes(struct panel *p);
+void add_hot_region(struct widget *w, int x, int width, long item);
+struct hot_region *panel_hot_region_at(struct panel *p, int x);
+long widget_item_at(struct widget *w, int x);
 void disp_button_press_release(struct panel *p, XButtonEvent *e);
 void disp_motion_notify(struct panel *p, XMotionEvent *e);
 void disp_property_notify(struct panel *p, XPropertyEvent *e);
@@ -1,80 +1,140 @@
+#include <stdio.h>
 #include "gui.h"
 
-#define IMAGES_CACHE_SIZE 128
+/* Images and image parts are kept while the total size of their pixel data
+ * fits the budget, the least recently used ones are evicted first. Cache
+ * keeps its own reference, so evicting an image which is still in use is
+ * harmless. The cache only lives during a theme load, it is emptied
+ * before and after (see clean_image_cache).
+ */
+#define IMAGES_CACHE_BUDGET (4*1024*1024)
 
 struct image {
-	char *filename;
+	char *key;
 	cairo_surface_t	*surface;
+	size_t size;
+
+	/* LRU list, head is the most recently used one */
+	struct image *prev;
+	struct image *next;
 };
 
-static size_t images_cache_n;
-static struct image *images_cache[IMAGES_CACHE_SIZE];
+static GHashTable *images_cache;
+static struct image *images_head;
+static struct image *images_tail;
+static size_t images_size;
 
-static struct image *load_image_from_file(const char *path)
+static void unlink_image(struct image *img)
 {
-	cairo_surface_t *surface = cairo_image_surface_create_from_png(path);
-	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
-		cairo_surface_destroy(surface);
-		return 0;
-	}
+	if (img->prev)
+		img->prev->next = img->next;
+	else
+		images_head = img->next;
+	if (img->next)
+		img->next->prev = img->prev;
+	else
+		images_tail = img->prev;
+	img->prev = img->next = 0;
+}
 
-	struct image *img = xmalloc(sizeof(struct image));
-	img->filename = xstrdup(path);
-	img->surface = surface;
-	return img;
+static void link_image(struct image *img)
+{
+	img->prev = 0;
+	img->next = images_head;
+	if (images_head)
+		images_head->prev = img;
+	images_head = img;
+	if (!images_tail)
+		images_tail = img;
 }
 
-static struct image *find_image_in_cache(const char *path)
+static void free_image(struct image *img, int final)
 {
-	size_t i;
-	for (i = 0; i < images_cache_n; ++i) {
-		if (strcmp(images_cache[i]->filename, path) == 0)
-			return images_cache[i];
-	}
-	return 0;
+	if (final && cairo_surface_get_reference_count(img->surface) > 1)
+		XWARNING("Image: \"%s\" has big ref count", img->key);
+	g_hash_table_remove(images_cache, img->key);
+	unlink_image(img);
+	images_size -= img->size;
+	xfree(img->key);
+	cairo_surface_destroy(img->surface);
+	xfree(img);
 }
 
-static void try_add_image_to_cache(struct image *img)
+static cairo_surface_t *find_image_in_cache(const char *key)
 {
-	if (images_cache_n == IMAGES_CACHE_SIZE)
-		return;
+	if (!images_cache)
+		return 0;
+
+	struct image *img = g_hash_table_lookup(images_cache, key);
+	if (!img)
+		return 0;
 
-	images_cache[images_cache_n++] = img;
+	unlink_image(img);
+	link_image(img);
+	cairo_surface_reference(img->surface);
+	return img->surface;
 }
 
-static void free_image(struct image *img, int final)
+static void add_image_to_cache(const char *key, cairo_surface_t *surface)
 {
-	if (final && cairo_surface_get_reference_count(img->surface) > 1)
-		XWARNING("Image: \"%s\" has big ref count", img->filename);
-	xfree(img->filename);
-	cairo_surface_destroy(img->surface);
-	xfree(img);
+	if (!images_cache)
+		images_cache = g_hash_table_new(g_str_hash, g_str_equal);
+
+	struct image *img = xmallocz(sizeof(struct image));
+	img->key = xstrdup(key);
+	img->surface = surface;
+	img->size = cairo_image_surface_get_stride(surface) *
+		cairo_image_surface_get_height(surface);
+	cairo_surface_reference(surface);
+
+	g_hash_table_insert(images_cache, img->key, img);
+	link_image(img);
+	images_size += img->size;
+
+	/* keep at least the new one */
+	while (images_tail != img && images_size > IMAGES_CACHE_BUDGET)
+		free_image(images_tail, 0);
 }
 
 cairo_surface_t *get_image(const char *path)
 {
-	struct image *img = find_image_in_cache(path);
-	if (img) {
-		cairo_surface_reference(img->surface);
-		return img->surface;
-	}
+	cairo_surface_t *surface = find_image_in_cache(path);
+	if (surface)
+		return surface;
 
-	img = load_image_from_file(path);
-	if (img) {
-		try_add_image_to_cache(img);
-		cairo_surface_reference(img->surface);
-		return img->surface;
+	surface = cairo_image_surface_create_from_png(path);
+	if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(surface);
+		return 0;
 	}
-	return 0;
+
+	add_image_to_cache(path, surface);
+	return surface;
 }
 
 cairo_surface_t *get_image_part(const char *path, int x, int y, int w, int h)
 {
+	/* the part key can't be confused with a path, config values (and
+	 * paths made of them) never contain new lines
+	 */
+	char buf[MAX_ALLOCA+1];
+	char *key;
+	size_t keylen = strlen(path) + 64;
+	if (keylen > MAX_ALLOCA)
+		key = xmalloc(keylen);
+	else
+		key = buf;
+	snprintf(key, keylen, "%s\n%d %d %d %d", path, x, y, w, h);
+
+	cairo_surface_t *dest = find_image_in_cache(key);
+	if (dest)
+		goto done;
+
 	cairo_surface_t *source = get_image(path);
 	if (!source)
-		return 0;
+		goto done;
 
-	cairo_surface_t *dest = cairo_image_surface_create(
+	dest = cairo_image_surface_create(
 			cairo_image_surface_get_format(source),
 			w,h);
 	ENSURE(cairo_surface_status(dest) == CAIRO_STATUS_SUCCESS,
@@ -86,13 +146,24 @@ cairo_surface_t *get_image_part(const char *path, int x, int y, int w, int h)
 	cairo_paint(cr);
 	cairo_destroy(cr);
 	cairo_surface_destroy(source);
+
+	add_image_to_cache(key, dest);
+done:
+	if (key != buf)
+		xfree(key);
 	return dest;
 }
 
+/* Entries are keyed by path only, theme files could be edited before the
+ * next load. Non-final cleanup just drops cache's references, images still
+ * used by widgets stay alive.
+ */
 void clean_image_cache(int final)
 {
-	size_t i;
-	for (i = 0; i < images_cache_n; ++i)
-		free_image(images_cache[i], final);
-	images_cache_n = 0;
+	while (images_head)
+		free_image(images_head, final);
+	if (final && images_cache) {
+		g_hash_table_destroy(images_cache);
+		images_cache = 0;
+	}
 }
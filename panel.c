@@ -3,6 +3,7 @@
 #include "gui.h"
 #include "settings.h"
 #include "widget-utils.h"
+#include "array.h"
 
 static int find_widget_in_stash(const char *interface, struct widget_stash *stash)
 {
@@ -113,13 +114,30 @@ static void free_panel_theme(struct panel_theme *theme)
 
 static void select_render_interface(struct panel *p)
 {
-	/* TODO: composite manager detection and composite render */
-	if (p->theme.transparent)
-		p->render = &render_pseudo;
-	else
+	struct x_connection *c = &p->connection;
+
+	/* visual of the panel window can't be changed after it's created,
+	 * composite render stays until restart
+	 */
+	if (p->render && p->render->argb)
+		return;
+
+	if (p->theme.transparent) {
+		if (!p->render && c->argb_visual && x_is_composited(c))
+			p->render = &render_composite;
+		else
+			p->render = &render_pseudo;
+	} else
 		p->render = &render_normal;
 }
 
+static Pixmap create_bg_pixmap(struct panel *p, int w, int h)
+{
+	if (p->render->argb)
+		return x_create_argb_pixmap(&p->connection, w, h);
+	return x_create_default_pixmap(&p->connection, w, h);
+}
+
 static int one_monitor_on_top_of_another(const struct x_monitor *one,
 					 const struct x_monitor *another)
 {
@@ -239,15 +257,21 @@ static void create_window(struct panel *panel, int monitor)
 	get_position_and_strut(c, t, monitor, &x, &y, &w, &h, strut);
 	panel->monitor = monitor;
 
-	panel->bg = x_create_default_pixmap(c, w, h);
+	panel->bg = create_bg_pixmap(panel, w, h);
 
 	XSetWindowAttributes attrs;
 	attrs.background_pixmap = panel->bg;
 	attrs.event_mask = ExposureMask | StructureNotifyMask | ButtonPressMask |
-		ButtonReleaseMask | PointerMotionMask | EnterWindowMask |
-		LeaveWindowMask;
-	panel->win = x_create_default_window(c, x, y, w, h,
-					     CWBackPixmap | CWEventMask, &attrs);
+		ButtonReleaseMask | PointerMotionMask | PointerMotionHintMask |
+		EnterWindowMask | LeaveWindowMask;
+	if (panel->render->argb)
+		panel->win = x_create_argb_window(c, x, y, w, h,
+						  CWBackPixmap | CWEventMask,
+						  &attrs);
+	else
+		panel->win = x_create_default_window(c, x, y, w, h,
+						     CWBackPixmap | CWEventMask,
+						     &attrs);
 
 	panel->x = x;
 	panel->y = y;
@@ -335,6 +359,7 @@ static void parse_panel_widgets(struct panel *panel, struct config_format_tree *
 		w->interface = we;
 		w->panel = panel;
 		w->needs_expose = 0;
+		w->deadline = 0;
 
 		if ((*we->create_widget_private)(w, e, tree) == 0) {
 			panel->widgets_n++;
@@ -375,6 +400,7 @@ static void retheme_reconfigure_panel_widgets(struct widget_stash *stash,
 		w->interface = we;
 		w->panel = panel;
 		w->needs_expose = 0;
+		w->deadline = 0;
 
 		int stashwi = find_widget_in_stash(e->name, stash);
 		if (stashwi != -1 && we->retheme_reconfigure) {
@@ -409,6 +435,67 @@ static void retheme_reconfigure_panel_widgets(struct widget_stash *stash,
 	reset_alternatives();
 }
 
+/**************************************************************************
+  Background layer
+**************************************************************************/
+
+static void free_bg_layer(struct panel *panel)
+{
+	if (panel->bg_layer) {
+		cairo_surface_destroy(panel->bg_layer);
+		panel->bg_layer = 0;
+	}
+}
+
+static void create_bg_layer(struct panel *panel)
+{
+	struct panel_theme *t = &panel->theme;
+
+	panel->bg_layer = cairo_surface_create_similar(cairo_get_target(panel->cr),
+						       CAIRO_CONTENT_COLOR_ALPHA,
+						       panel->width,
+						       panel->height);
+	ENSURE(cairo_surface_status(panel->bg_layer) == CAIRO_STATUS_SUCCESS,
+	       "Failed to create cairo surface");
+
+	cairo_t *cr = cairo_create(panel->bg_layer);
+	pattern_image(t->background, cr, 0, 0, panel->width, 0);
+
+	/* separators go to the gaps left by recalculate_widgets_sizes */
+	size_t i;
+	for (i = 0; t->separator && i < panel->widgets_n; ++i) {
+		struct widget *w = &panel->widgets[i];
+		if (!w->width)
+			continue;
+
+		int x = w->x + w->width;
+		int next = panel->width;
+		size_t j;
+		for (j = i + 1; j < panel->widgets_n; ++j) {
+			if (panel->widgets[j].width) {
+				next = panel->widgets[j].x;
+				break;
+			}
+		}
+		if (x < next)
+			blit_image(t->separator, cr, x, 0);
+	}
+	cairo_destroy(cr);
+}
+
+/* paints a part of the background layer, "x" is in panel coordinates */
+static void paint_bg_layer(struct panel *panel, int x, int width)
+{
+	if (!panel->bg_layer)
+		create_bg_layer(panel);
+	blit_image_ex(panel->bg_layer, panel->cr, x, 0, width, panel->height,
+		      x, 0);
+}
+
+/**************************************************************************
+  Widgets layout
+**************************************************************************/
+
 void recalculate_widgets_sizes(struct panel *panel)
 {
 	const int min_fill_size = 200;
@@ -470,16 +557,71 @@ void recalculate_widgets_sizes(struct panel *panel)
 	panel->widgets[i].x = x;
 	panel->widgets[i].width = x2 - x;
 
+	/* separators have moved */
+	free_bg_layer(panel);
+	panel->hot_regions_dirty = 1;
+
 	/* request redraw */
 	panel->needs_expose = 1;
 }
 
+/**************************************************************************
+  Damage tracking
+**************************************************************************/
+
+static void add_damage(struct panel *panel, struct widget *w, int x, int width)
+{
+	/* damage never leaves the widget, separators are not repainted */
+	int x2 = MININT(x + width, w->x + w->width);
+	x = MAXINT(x, w->x);
+	if (x2 <= x)
+		return;
+
+	/* union with overlapping or adjacent spans of the same widget */
+	size_t i = 0;
+	while (i < panel->damage_n) {
+		struct damage_span *ds = &panel->damage[i];
+		if (ds->widget != w || x > ds->x + ds->width || x2 < ds->x) {
+			i++;
+			continue;
+		}
+		x = MININT(x, ds->x);
+		x2 = MAXINT(x2, ds->x + ds->width);
+		*ds = panel->damage[--panel->damage_n];
+		i = 0; /* the grown span may touch the others now */
+	}
+
+	if (panel->damage_n == PANEL_MAX_DAMAGE) {
+		/* too fragmented, repaint the whole widget */
+		w->needs_expose = 1;
+		return;
+	}
+
+	struct damage_span *ds = &panel->damage[panel->damage_n++];
+	ds->widget = w;
+	ds->x = x;
+	ds->width = x2 - x;
+}
+
+void widget_damage(struct widget *w, int x, int width)
+{
+	/* whole widget will be repainted anyway */
+	if (w->needs_expose || w->panel->needs_expose)
+		return;
+
+	add_damage(w->panel, w, x, width);
+}
+
+/**************************************************************************
+  Exposing
+**************************************************************************/
+
 static void expose_whole_panel(struct panel *panel)
 {
 	Display *dpy = panel->connection.dpy;
 
-	int sepw = 0;
-	sepw += image_width(panel->theme.separator);
+	/* background and separators */
+	paint_bg_layer(panel, 0, panel->width);
 
 	size_t i;
 	for (i = 0; i < panel->widgets_n; ++i) {
@@ -489,30 +631,25 @@ static void expose_whole_panel(struct panel *panel)
 		if (!w) /* skip empty */
 			continue;
 
-		/* background */
-		pattern_image(panel->theme.background, panel->cr, x, 0, w, 0);
-
+		/* widget contents, kept off the separators */
 		cairo_save(panel->cr);
+		cairo_rectangle(panel->cr, x, 0, w, panel->height);
+		cairo_clip(panel->cr);
 		if (wi->paint_replace)
 			cairo_set_operator(panel->cr, CAIRO_OPERATOR_SOURCE);
-
-		/* widget contents */
 		if (wi->interface->draw)
 			(*wi->interface->draw)(wi);
 		cairo_restore(panel->cr);
 
-		/* separator */
-		x += w;
-		if (panel->theme.separator && panel->widgets_n - 1 != i)
-			blit_image(panel->theme.separator, panel->cr, x, 0);
-
 		/* widget was drawn, clear "needs_expose" flag */
 		wi->needs_expose = 0;
 	}
+	panel->hot_regions_dirty = 1;
 
 	(*panel->render->blit)(panel, 0, 0, panel->width, panel->height);
 	XFlush(dpy);
 	panel->needs_expose = 0;
+	panel->damage_n = 0;
 
 	/* after exposing panel actions, for those who need panel background
 	 * (e.g. systray icons)
@@ -525,6 +662,29 @@ static void expose_whole_panel(struct panel *panel)
 	XFlush(dpy);
 }
 
+/* repaints and blits a part of the widget, "x" is in panel coordinates */
+static void expose_widget_region(struct panel *panel, struct widget *w,
+				 int x, int width)
+{
+	cairo_t *cr = panel->cr;
+
+	if (!width)
+		return;
+
+	cairo_save(cr);
+	cairo_rectangle(cr, x, 0, width, panel->height);
+	cairo_clip(cr);
+
+	paint_bg_layer(panel, x, width);
+	if (w->paint_replace)
+		cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	if (w->interface->draw)
+		(*w->interface->draw)(w);
+	cairo_restore(cr);
+
+	(*panel->render->blit)(panel, x, 0, width, panel->height);
+}
+
 static void expose_panel(struct panel *panel)
 {
 	Display *dpy = panel->connection.dpy;
@@ -534,28 +694,107 @@ static void expose_panel(struct panel *panel)
 		return;
 	}
 
+	/* damaged regions of widgets which are not exposed entirely */
 	size_t i;
+	for (i = 0; i < panel->damage_n; ++i) {
+		struct damage_span *ds = &panel->damage[i];
+		if (ds->widget->needs_expose)
+			continue;
+		expose_widget_region(panel, ds->widget, ds->x, ds->width);
+	}
+	panel->damage_n = 0;
+
 	for (i = 0; i < panel->widgets_n; ++i) {
 		struct widget *w = &panel->widgets[i];
 		if (!w->needs_expose)
 			continue;
 
-		pattern_image(panel->theme.background, panel->cr,
-				w->x, 0, w->width, 0);
-		cairo_save(panel->cr);
-		if (w->paint_replace)
-			cairo_set_operator(panel->cr, CAIRO_OPERATOR_SOURCE);
-		if (w->interface->draw)
-			(*w->interface->draw)(w);
-		cairo_restore(panel->cr);
-
-		(*panel->render->blit)(panel, w->x, 0,
-				       w->width, panel->height);
+		expose_widget_region(panel, w, w->x, w->width);
 		w->needs_expose = 0;
+
+		/* items of the widget could have moved */
+		panel->hot_regions_dirty = 1;
 	}
 	XFlush(dpy);
 }
 
+/**************************************************************************
+  Frame scheduling
+**************************************************************************/
+
+/* Panel selects motion hints: X server sends one MotionNotify and stays
+ * quiet until we ask where the pointer is. Motion is dispatched once per
+ * frame with the position sampled right before rendering, so hovering and
+ * dragging (which moves the DnD icon window) cost one round trip per frame
+ * instead of an event per pixel. "query" is zero when the pending motion
+ * must be dispatched as it is, before a click or a crossing event.
+ */
+static void dispatch_motion(struct panel *p, int query)
+{
+	if (!p->motion_pending)
+		return;
+	p->motion_pending = 0;
+
+	XMotionEvent *e = &p->motion;
+	if (query) {
+		Window root, child;
+		int root_x, root_y, x, y;
+		unsigned int mask;
+
+		/* pointer is on another screen */
+		if (!XQueryPointer(p->connection.dpy, p->win, &root, &child,
+				   &root_x, &root_y, &x, &y, &mask))
+			return;
+
+		e->x_root = root_x;
+		e->y_root = root_y;
+		e->x = x;
+		e->y = y;
+		e->state = mask;
+		e->is_hint = NotifyNormal;
+	}
+	disp_motion_notify(p, e);
+}
+
+static void render_frame(struct panel *p)
+{
+	dispatch_motion(p, 1);
+	expose_panel(p);
+}
+
+static gboolean panel_frame(gpointer data)
+{
+	struct panel *p = data;
+	p->frame_source = 0;
+	render_frame(p);
+	return 0;
+}
+
+/* Renders pending changes at most once per "frame_interval", so a burst
+ * of events spread over several batches causes only one expose.
+ */
+static void schedule_frame(struct panel *p)
+{
+	if (!p->frame_interval) {
+		render_frame(p);
+		return;
+	}
+
+	if (!p->frame_source)
+		p->frame_source = g_timeout_add(p->frame_interval,
+						panel_frame, p);
+}
+
+/* renders pending changes right now, pending frame becomes useless */
+static void flush_frame(struct panel *p)
+{
+	if (p->frame_source) {
+		g_source_remove(p->frame_source);
+		p->frame_source = 0;
+	}
+	render_frame(p);
+}
+
 void init_panel(struct panel *panel, struct config_format_tree *tree,
 		int monitor)
 {
@@ -588,6 +827,7 @@ void init_panel(struct panel *panel, struct config_format_tree *tree,
 
 	/* parse panel widgets */
 	parse_panel_widgets(panel, tree);
+	build_event_routes(panel);
 	recalculate_widgets_sizes(panel);
 
 	/* all ok, map window */
@@ -604,6 +844,11 @@ void free_panel(struct panel *panel)
 {
 	size_t i;
 
+	if (panel->frame_source)
+		g_source_remove(panel->frame_source);
+	if (panel->timer_source)
+		g_source_remove(panel->timer_source);
+
 	if (panel->render->free_private)
 		(*panel->render->free_private)(panel);
 
@@ -613,10 +858,14 @@ void free_panel(struct panel *panel)
 	}
 	panel->widgets_n = 0;
 
+	clean_text_cache();
+	free_bg_layer(panel);
 	g_object_unref(panel->layout);
 	cairo_destroy(panel->cr);
 	XDestroyWindow(panel->connection.dpy, panel->win);
 	XFreePixmap(panel->connection.dpy, panel->bg);
+	free_event_routes(panel);
+	FREE_ARRAY(panel->hot_regions);
 	free_panel_theme(&panel->theme);
 	x_disconnect(&panel->connection);
 }
@@ -634,8 +883,11 @@ void reconfigure_free_panel(struct panel *panel, struct widget_stash *stash)
 
 	panel->widgets_n = 0;
 
+	clean_text_cache();
+	free_bg_layer(panel);
 	g_object_unref(panel->layout);
 	cairo_destroy(panel->cr);
+	free_event_routes(panel);
 	free_panel_theme(&panel->theme);
 }
 
@@ -668,7 +920,7 @@ void reconfigure_panel(struct panel *panel, struct config_format_tree *tree,
 	panel->height = h;
 
 	XFreePixmap(panel->connection.dpy, panel->bg);
-	panel->bg = x_create_default_pixmap(c, w, h);
+	panel->bg = create_bg_pixmap(panel, w, h);
 
 	/* render private */
 	if (panel->render->create_private)
@@ -688,6 +940,7 @@ void reconfigure_panel(struct panel *panel, struct config_format_tree *tree,
 		(*w->interface->destroy_widget_private)(w);
 	}
 	xfree(stash->widgets);
+	build_event_routes(panel);
 	recalculate_widgets_sizes(panel);
 
 	/* all ok, update window */
@@ -720,6 +973,12 @@ void reconfigure_panel_config(struct panel *panel)
 	panel->mbutton[0] = parse_mbutton_state("mbutton1", MBUTTON_1_DEFAULT);
 	panel->mbutton[1] = parse_mbutton_state("mbutton2", MBUTTON_2_DEFAULT);
 	panel->mbutton[2] = parse_mbutton_state("mbutton3", MBUTTON_3_DEFAULT);
+	panel->frame_interval = parse_int("frame_interval",
+					  &g_settings.root, 16);
+	if (panel->frame_interval < 0)
+		panel->frame_interval = 0;
+	panel->frame_coalesce_input = parse_bool("frame_coalesce_input",
+						 &g_settings.root);
 }
 
 void reconfigure_widgets(struct panel *panel)
@@ -749,6 +1008,11 @@ static void panel_button_press_release(struct panel *p, XButtonEvent *e)
 
 static void panel_property_notify(struct panel *p, XPropertyEvent *e)
 {
+	if (e->atom == p->connection.atoms[XATOM_NET_FRAME_EXTENTS]) {
+		x_geometry_frame_extents(&p->connection, e->window);
+		return;
+	}
+
 	if (e->atom == p->connection.atoms[XATOM_XROOTPMAP_ID]) {
 		x_update_root_pmap(&p->connection);
 		if (p->render->update_bg)
@@ -810,92 +1074,250 @@ static void panel_expose(struct panel *p, XExposeEvent *e)
 		(*p->render->expose)(p);
 }
 
-static int process_events(struct panel *p)
+/* Handlers of ConfigureNotify and PropertyNotify re-read the current state
+ * from the server, so only the last ConfigureNotify per window and the
+ * last PropertyNotify per (window, atom) in a batch are worth handling.
+ * Useful when windows are dragged around, each drag step is an event.
+ */
+static guint property_event_hash(gconstpointer key)
 {
-	Display *dpy = p->connection.dpy;
-	int events_processed = 0;
+	const XPropertyEvent *e = key;
+	return (guint)e->window * 31 + (guint)e->atom;
+}
 
-	while (XPending(dpy)) {
-		XEvent e;
+static gboolean property_event_equal(gconstpointer a, gconstpointer b)
+{
+	const XPropertyEvent *ea = a;
+	const XPropertyEvent *eb = b;
+	return ea->window == eb->window && ea->atom == eb->atom;
+}
 
-		events_processed++;
-		XNextEvent(dpy, &e);
+static void compress_events(XEvent *events, size_t n, char *skip)
+{
+	GHashTable *configures = g_hash_table_new(g_direct_hash, g_direct_equal);
+	GHashTable *props = g_hash_table_new(property_event_hash,
+					     property_event_equal);
+	size_t i = n;
+	while (i--) {
+		XEvent *e = &events[i];
+		skip[i] = 0;
+		if (e->type == ConfigureNotify) {
+			gpointer key = GUINT_TO_POINTER(e->xconfigure.window);
+			if (g_hash_table_lookup(configures, key))
+				skip[i] = 1;
+			else
+				g_hash_table_insert(configures, key, e);
+		} else if (e->type == PropertyNotify) {
+			if (g_hash_table_lookup(props, &e->xproperty))
+				skip[i] = 1;
+			else
+				g_hash_table_insert(props, &e->xproperty, e);
+		}
+	}
+	g_hash_table_destroy(configures);
+	g_hash_table_destroy(props);
+}
 
-		switch (e.type) {
+/* returns 1 for user input events */
+static int handle_event(struct panel *p, XEvent *e)
+{
+	int input = 0;
+
+	switch (e->type) {
+
+	case NoExpose:
+	case MapNotify:
+	case UnmapNotify:
+	case VisibilityNotify:
+	case SelectionClear:
+		/* skip? */
+		break;
+
+	case ReparentNotify:
+		x_geometry_reparent(&p->connection, &e->xreparent);
+		break;
+
+	case Expose:
+		panel_expose(p, &e->xexpose);
+		break;
+
+	case ButtonRelease:
+	case ButtonPress:
+		/* drag detection depends on the order of motion and clicks */
+		dispatch_motion(p, 0);
+		panel_button_press_release(p, &e->xbutton);
+		disp_button_press_release(p, &e->xbutton);
+		input = 1;
+		break;
+
+	case MotionNotify:
+		/* the newest one wins, see dispatch_motion */
+		p->motion = e->xmotion;
+		p->motion_pending = 1;
+		break;
+
+	case EnterNotify:
+	case LeaveNotify:
+		dispatch_motion(p, 0);
+		disp_enter_leave_notify(p, &e->xcrossing);
+		input = 1;
+		break;
+
+	case PropertyNotify:
+		panel_property_notify(p, &e->xproperty);
+		disp_property_notify(p, &e->xproperty);
+		break;
+
+	case ClientMessage:
+		disp_client_msg(p, &e->xclient);
+		break;
+
+	case ConfigureNotify:
+		/* widgets read tracked geometry, update it first */
+		x_geometry_configure(&p->connection, &e->xconfigure);
+		panel_configure_notify(p, &e->xconfigure);
+		disp_configure(p, &e->xconfigure);
+		break;
+
+	case DestroyNotify:
+		disp_win_destroy(p, &e->xdestroywindow);
+		x_untrack_window(&p->connection, e->xdestroywindow.window);
+		break;
+
+	default:
+		XWARNING("Unknown XEvent (type: %d, win: %d)",
+			 e->type, e->xany.window);
+		break;
+	}
+	return input;
+}
 
-		case NoExpose:
-		case MapNotify:
-		case UnmapNotify:
-		case VisibilityNotify:
-		case ReparentNotify:
-		case SelectionClear:
-			/* skip? */
-			break;
+static int process_events(struct panel *p)
+{
+	Display *dpy = p->connection.dpy;
+	int events_processed = 0;
+	int input_processed = 0;
 
-		case Expose:
-			panel_expose(p, &e.xexpose);
-			break;
+	XEvent *events;
+	size_t events_n;
+	size_t events_alloc;
+	INIT_EMPTY_ARRAY(events);
 
-		case ButtonRelease:
-		case ButtonPress:
-			panel_button_press_release(p, &e.xbutton);
-			disp_button_press_release(p, &e.xbutton);
-			break;
+	while (XPending(dpy)) {
+		/* drain the queue, then handle what's left after compression */
+		CLEAR_ARRAY(events);
+		while (XPending(dpy)) {
+			ENSURE_ARRAY_CAPACITY(events, events_n + 1);
+			XNextEvent(dpy, &events[events_n++]);
+		}
 
-		case MotionNotify:
-			disp_motion_notify(p, &e.xmotion);
-			break;
+		char *skip = xmalloc(events_n);
+		compress_events(events, events_n, skip);
 
-		case EnterNotify:
-		case LeaveNotify:
-			disp_enter_leave_notify(p, &e.xcrossing);
-			break;
+		size_t i;
+		for (i = 0; i < events_n; ++i) {
+			if (skip[i])
+				continue;
+			events_processed++;
+			if (handle_event(p, &events[i]))
+				input_processed = 1;
+		}
+		xfree(skip);
+	}
+	FREE_ARRAY(events);
 
-		case PropertyNotify:
-			panel_property_notify(p, &e.xproperty);
-			disp_property_notify(p, &e.xproperty);
-			break;
+	if (events_processed) {
+		/* keep click feedback snappy, motion waits for the frame */
+		if (input_processed && !p->frame_coalesce_input)
+			flush_frame(p);
+		else
+			schedule_frame(p);
+	}
+	return events_processed;
+}
 
-		case ClientMessage:
-			disp_client_msg(p, &e.xclient);
-			break;
+/**************************************************************************
+  Timer
+**************************************************************************/
 
-		case ConfigureNotify:
-			panel_configure_notify(p, &e.xconfigure);
-			disp_configure(p, &e.xconfigure);
-			break;
+/* Widgets ask to be woken up at a deadline instead of being polled every
+ * second, so an idle panel doesn't wake up at all. Deadlines are wall
+ * clock times, that's what clocks display.
+ */
+static gboolean panel_timer(gpointer data);
 
-		case DestroyNotify:
-			disp_win_destroy(p, &e.xdestroywindow);
-			break;
+/* (re)arms the timer for "deadline", 0 disarms it */
+static void arm_timer_at(struct panel *p, gint64 deadline)
+{
+	if (p->timer_source) {
+		if (deadline == p->timer_deadline)
+			return;
+		g_source_remove(p->timer_source);
+		p->timer_source = 0;
+	}
+	if (!deadline)
+		return;
 
-		default:
-			XWARNING("Unknown XEvent (type: %d, win: %d)",
-				 e.type, e.xany.window);
-			break;
-		}
+	/* rounded up, waking up before the deadline is useless */
+	gint64 delay = deadline - g_get_real_time();
+	delay = delay > 0 ? (delay + 999) / 1000 : 0;
+	p->timer_deadline = deadline;
+	p->timer_source = g_timeout_add((guint)delay, panel_timer, p);
+}
+
+/* for the earliest deadline of all widgets */
+static void arm_timer(struct panel *p)
+{
+	gint64 deadline = 0;
+	size_t i;
+	for (i = 0; i < p->widgets_n; ++i) {
+		gint64 d = p->widgets[i].deadline;
+		if (d && (!deadline || d < deadline))
+			deadline = d;
 	}
-	if (events_processed)
-		expose_panel(p);
-	return events_processed;
+	arm_timer_at(p, deadline);
 }
 
-static gboolean panel_second_timeout(gpointer data)
+static gboolean panel_timer(gpointer data)
 {
 	struct panel *p = data;
+	gint64 now = g_get_real_time();
 	size_t i;
-	struct widget *w;
+
+	p->timer_source = 0;
 	for (i = 0; i < p->widgets_n; ++i) {
-		w = &p->widgets[i];
+		struct widget *w = &p->widgets[i];
+		if (!w->deadline || w->deadline > now)
+			continue;
+		w->deadline = 0;
 		if (w->interface->clock_tick)
 			(*w->interface->clock_tick)(w);
 	}
-	expose_panel(p);
+	arm_timer(p);
+	schedule_frame(p);
 	/* just in case, actually it helps a lot */
 	process_events(p);
-	return 1;
+	return 0;
+}
+
+/* "clock_tick" is called once after "deadline" passes, 0 cancels it */
+void widget_set_deadline(struct widget *w, gint64 deadline)
+{
+	struct panel *p = w->panel;
+	w->deadline = deadline;
+
+	/* Later deadlines are picked up when the armed timer fires. Arming
+	 * doesn't rescan widgets, "w" isn't counted in "widgets_n" yet while
+	 * its create_widget_private runs.
+	 */
+	if (deadline && (!p->timer_source || deadline < p->timer_deadline))
+		arm_timer_at(p, deadline);
 }
 
+/**************************************************************************
+  Main loop
+**************************************************************************/
+
 static gboolean panel_x_in(GIOChannel *gio, GIOCondition condition, gpointer data)
 {
 	/* TODO: be aware of connection drop */
@@ -918,8 +1340,6 @@ void panel_main_loop(struct panel *panel)
 	g_io_add_watch(x, G_IO_IN | G_IO_HUP, panel_x_in, panel);
 	g_io_channel_unref(x);
 
-	g_timeout_add(1000, panel_second_timeout, panel);
-
 	g_main_loop_run(panel->loop);
 	g_main_loop_unref(panel->loop);
 }
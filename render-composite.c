@@ -0,0 +1,116 @@
+#include "gui.h"
+#include "widget-utils.h"
+
+static void create_dc(struct panel *p);
+static void blit(struct panel *p, int x, int y, unsigned int w, unsigned int h);
+static void create_private(struct panel *p);
+static void free_private(struct panel *p);
+static void panel_resize(struct panel *p);
+
+struct render_interface render_composite = {
+	.name = "composite",
+	.argb = 1,
+	.create_dc = create_dc,
+	.blit = blit,
+	.create_private = create_private,
+	.free_private = free_private,
+	.panel_resize = panel_resize
+};
+
+/*
+ * Panel window and p->bg are 32 bit ARGB, compositing manager blends them
+ * with whatever is below, so there is no wallpaper to track.
+ *
+ * p->cr draws to "buf", damaged parts are copied to p->bg as is (pixels
+ * are already premultiplied) and cleared for the next frame. p->bg can't be
+ * cleared itself, X server uses it for exposes.
+ */
+struct composite_render {
+	Pixmap buf;
+	GC gc;
+};
+
+static cairo_t *create_cairo_for_argb_pixmap(struct x_connection *c,
+					     Pixmap p, int w, int h)
+{
+	cairo_surface_t *surface = cairo_xlib_surface_create(c->dpy,
+							     p, c->argb_visual,
+							     w, h);
+	ENSURE(cairo_surface_status(surface) == CAIRO_STATUS_SUCCESS,
+	       "Error creating xlib/cairo surface");
+
+	cairo_t *cr = cairo_create(surface);
+	cairo_surface_destroy(surface);
+
+	ENSURE(cairo_status(cr) == CAIRO_STATUS_SUCCESS,
+	       "Error creating cairo context");
+
+	return cr;
+}
+
+static void clear_rect(cairo_t *cr, int x, int y, int w, int h)
+{
+	cairo_save(cr);
+	cairo_rectangle(cr, x, y, w, h);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_rgba(cr, 0, 0, 0, 0);
+	cairo_fill(cr);
+	cairo_restore(cr);
+}
+
+static void create_private(struct panel *p)
+{
+	struct x_connection *c = &p->connection;
+	struct composite_render *cr = xmallocz(sizeof(struct composite_render));
+
+	cr->buf = x_create_argb_pixmap(c, p->width, p->height);
+	cr->gc = XCreateGC(c->dpy, cr->buf, 0, 0);
+	p->render_private = (void*)cr;
+}
+
+static void free_private(struct panel *p)
+{
+	Display *dpy = p->connection.dpy;
+	struct composite_render *cr = p->render_private;
+
+	XFreeGC(dpy, cr->gc);
+	XFreePixmap(dpy, cr->buf);
+	xfree(cr);
+}
+
+static void create_dc(struct panel *p)
+{
+	struct composite_render *cr = p->render_private;
+
+	p->cr = create_cairo_for_argb_pixmap(&p->connection, cr->buf,
+					     p->width, p->height);
+	clear_rect(p->cr, 0, 0, p->width, p->height);
+}
+
+static void blit(struct panel *p, int x, int y, unsigned int w, unsigned int h)
+{
+	Display *dpy = p->connection.dpy;
+	struct composite_render *cr = p->render_private;
+
+	cairo_surface_flush(cairo_get_target(p->cr));
+	XCopyArea(dpy, cr->buf, p->bg, cr->gc, x, y, w, h, x, y);
+	clear_rect(p->cr, x, y, w, h);
+	XClearArea(dpy, p->win, x, y, w, h, False);
+}
+
+static void panel_resize(struct panel *p)
+{
+	struct x_connection *c = &p->connection;
+	struct composite_render *cr = p->render_private;
+
+	/* p->bg */
+	XFreePixmap(c->dpy, p->bg);
+	p->bg = x_create_argb_pixmap(c, p->width, p->height);
+	XSetWindowBackgroundPixmap(c->dpy, p->win, p->bg);
+
+	/* cr->buf and p->cr */
+	cairo_destroy(p->cr);
+	XFreePixmap(c->dpy, cr->buf);
+	cr->buf = x_create_argb_pixmap(c, p->width, p->height);
+	create_dc(p);
+}
@@ -21,14 +21,88 @@ struct render_interface render_pseudo = {
 /*
  * blit_cr is a real p->bg interface
  * backbuf is a storage for p->cr
+ *
+ * If MIT-SHM is available, backbuf lives in shared memory. Damaged parts
+ * are uploaded to "gui" pixmap without a copy through the socket and
+ * composited with the wallpaper by X server.
+ *
+ * wallpaper is a panel sized slice of the root pixmap, it is copied once
+ * per wallpaper change or panel resize, blits never touch the (possibly
+ * huge) root pixmap itself.
  */
 struct pseudo_render {
 	Pixmap buf;
 	cairo_t *buf_cr;
 	cairo_t *blit_cr;
+	Pixmap wallpaper_pixmap;
 	cairo_surface_t *wallpaper;
+
+	struct x_shm_image *shm; /* owned by p->cr surface */
+	Pixmap gui;
+	cairo_surface_t *gui_surface;
+	GC gc;
 };
 
+static cairo_user_data_key_t shm_key;
+
+static void free_shm(void *data)
+{
+	x_destroy_shm_image(data);
+}
+
+static void free_gui_pixmap(struct panel *p)
+{
+	Display *dpy = p->connection.dpy;
+	struct pseudo_render *pr = p->render_private;
+
+	if (pr->gui == None)
+		return;
+
+	cairo_surface_destroy(pr->gui_surface);
+	XFreeGC(dpy, pr->gc);
+	XFreePixmap(dpy, pr->gui);
+	pr->gui = None;
+	pr->shm = 0;
+}
+
+static void free_wallpaper(struct panel *p)
+{
+	struct pseudo_render *pr = p->render_private;
+
+	if (!pr->wallpaper)
+		return;
+
+	cairo_surface_destroy(pr->wallpaper);
+	XFreePixmap(p->connection.dpy, pr->wallpaper_pixmap);
+	pr->wallpaper = 0;
+	pr->wallpaper_pixmap = None;
+}
+
+static void update_wallpaper(struct panel *p)
+{
+	struct x_connection *c = &p->connection;
+	struct pseudo_render *pr = p->render_private;
+
+	free_wallpaper(p);
+	if (c->root_pixmap == None)
+		return;
+
+	pr->wallpaper_pixmap = x_create_default_pixmap(c, p->width, p->height);
+	cairo_t *cr = create_cairo_for_pixmap(c, pr->wallpaper_pixmap,
+					      p->width, p->height);
+	cairo_surface_t *root = create_cairo_surface_for_pixmap(c, c->root_pixmap,
+								c->screen_width,
+								c->screen_height);
+	/* parts outside of the root pixmap become black */
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	blit_image_ex(root, cr, p->x, p->y, p->width, p->height, 0, 0);
+	cairo_surface_destroy(root);
+	cairo_destroy(cr);
+
+	pr->wallpaper = create_cairo_surface_for_pixmap(c, pr->wallpaper_pixmap,
+							p->width, p->height);
+}
+
 static void create_private(struct panel *p)
 {
 	struct x_connection *c = &p->connection;
@@ -37,12 +111,9 @@ static void create_private(struct panel *p)
 	pr->blit_cr = create_cairo_for_pixmap(c, p->bg, p->width, p->height);
 	pr->buf = x_create_default_pixmap(c, p->width, p->height);
 	pr->buf_cr = create_cairo_for_pixmap(c, pr->buf, p->width, p->height);
-
-	if (c->root_pixmap != None)
-		pr->wallpaper = create_cairo_surface_for_pixmap(c, c->root_pixmap,
-								c->screen_width,
-								c->screen_height);
 	p->render_private = (void*)pr;
+
+	update_wallpaper(p);
 }
 
 static void free_private(struct panel *p)
@@ -51,16 +122,43 @@ static void free_private(struct panel *p)
 	struct pseudo_render *pr = p->render_private;
 	cairo_destroy(pr->buf_cr);
 	cairo_destroy(pr->blit_cr);
-	if (pr->wallpaper)
-		cairo_surface_destroy(pr->wallpaper);
+	free_wallpaper(p);
 	XFreePixmap(dpy, pr->buf);
+	free_gui_pixmap(p);
 	xfree(pr);
 }
 
 static void create_dc(struct panel *p)
 {
-	cairo_surface_t *backbuf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
-							      p->width, p->height);
+	struct x_connection *c = &p->connection;
+	struct pseudo_render *pr = p->render_private;
+	cairo_surface_t *backbuf;
+
+	if (c->argb_visual)
+		pr->shm = x_create_shm_image(c, c->argb_visual, 32,
+					     p->width, p->height);
+	if (pr->shm) {
+		XImage *img = pr->shm->image;
+		backbuf = cairo_image_surface_create_for_data(
+				(unsigned char*)img->data, CAIRO_FORMAT_ARGB32,
+				p->width, p->height, img->bytes_per_line);
+		ENSURE(cairo_surface_status(backbuf) == CAIRO_STATUS_SUCCESS,
+		       "Failed to create cairo image surface");
+		cairo_status_t st;
+		st = cairo_surface_set_user_data(backbuf, &shm_key, pr->shm,
+						 free_shm);
+		ENSURE(st == CAIRO_STATUS_SUCCESS,
+		       "Failed to set user data for surface");
+
+		pr->gui = XCreatePixmap(c->dpy, c->root, p->width, p->height, 32);
+		pr->gui_surface = cairo_xlib_surface_create(c->dpy, pr->gui,
+							    c->argb_visual,
+							    p->width, p->height);
+		pr->gc = XCreateGC(c->dpy, pr->gui, 0, 0);
+	} else {
+		backbuf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+						     p->width, p->height);
+	}
 
 	p->cr = cairo_create(backbuf);
 	cairo_surface_destroy(backbuf);
@@ -70,23 +168,38 @@ static void blit(struct panel *p, int x, int y, unsigned int w, unsigned int h)
 {
 	Display *dpy = p->connection.dpy;
 	struct pseudo_render *pr = p->render_private;
+	cairo_surface_t *gui = cairo_get_target(p->cr);
+
+	/* upload damaged part of the gui */
+	if (pr->gui != None) {
+		cairo_surface_flush(gui);
+		x_put_shm_image(pr->shm, pr->gui, pr->gc, x, y, w, h);
+		gui = pr->gui_surface;
+	}
 
 	/* draw wallpaper or clear buffer */
 	if (pr->wallpaper) {
-		blit_image_ex(pr->wallpaper, pr->buf_cr, p->x + x, p->y + y,
-			      w, h, x, y);
+		blit_image_ex(pr->wallpaper, pr->buf_cr, x, y, w, h, x, y);
 	} else {
 		cairo_save(pr->buf_cr);
+		cairo_rectangle(pr->buf_cr, x, y, w, h);
 		cairo_set_source_rgb(pr->buf_cr, 0,0,0);
-		cairo_paint(pr->buf_cr);
+		cairo_fill(pr->buf_cr);
 		cairo_restore(pr->buf_cr);
 	}
 	/* composite gui with background */
-	blit_image_ex(cairo_get_target(p->cr), pr->buf_cr, x, y, w, h, x, y);
+	blit_image_ex(gui, pr->buf_cr, x, y, w, h, x, y);
+
+	/* X server reads shared memory asynchronously, wait for it */
+	if (pr->gui != None)
+		XSync(dpy, False);
+
+	/* clear only the blitted part, the rest may be exposed later */
 	cairo_save(p->cr);
+	cairo_rectangle(p->cr, x, y, w, h);
 	cairo_set_operator(p->cr, CAIRO_OPERATOR_SOURCE);
 	cairo_set_source_rgba(p->cr, 0, 0, 0, 0);
-	cairo_paint(p->cr);
+	cairo_fill(p->cr);
 	cairo_restore(p->cr);
 
 	/* put everything to the background pixmap and clear area */
@@ -96,15 +209,7 @@ static void blit(struct panel *p, int x, int y, unsigned int w, unsigned int h)
 
 static void update_bg(struct panel *p)
 {
-	struct x_connection *c = &p->connection;
-	struct pseudo_render *pr = p->render_private;
-
-	cairo_surface_destroy(pr->wallpaper);
-
-	if (c->root_pixmap != None)
-		pr->wallpaper = create_cairo_surface_for_pixmap(c, c->root_pixmap,
-								c->screen_width,
-								c->screen_height);
+	update_wallpaper(p);
 	p->needs_expose = 1;
 }
 
@@ -117,12 +222,9 @@ static void panel_resize(struct panel *p)
 	update_bg(p);
 
 	/* p->cr */
+	free_gui_pixmap(p);
 	cairo_destroy(p->cr);
-	cairo_surface_t *backbuf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
-							      p->width, p->height);
-
-	p->cr = cairo_create(backbuf);
-	cairo_surface_destroy(backbuf);
+	create_dc(p);
 
 	/* p->bg */
 	XFreePixmap(c->dpy, p->bg);
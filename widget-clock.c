@@ -55,19 +55,135 @@ static void fill_buftime(char *buf, size_t size, struct clock_theme *ct)
 	strftime(buf, size, ct->time_format, localtime(&current_time));
 }
 
-static int get_clock_width(struct widget *w, const char *bufover)
+#define CLOCK_SECOND 1
+#define CLOCK_MINUTE 60
+#define CLOCK_HOUR 3600
+#define CLOCK_DAY 86400
+
+/* wake up at least that often anyway, to notice system clock changes */
+#define CLOCK_MAX_SLEEP 3600
+
+static int conversion_unit(char c)
+{
+	switch (c) {
+	case '%': case 'n': case 't':
+		return 0;
+	case 'M': case 'R':
+		return CLOCK_MINUTE;
+	case 'H': case 'I': case 'k': case 'l': case 'p': case 'P':
+	case 'z': case 'Z': /* DST changes at whole hours */
+		return CLOCK_HOUR;
+	case 'a': case 'A': case 'b': case 'B': case 'h': case 'C':
+	case 'd': case 'e': case 'D': case 'F': case 'g': case 'G':
+	case 'j': case 'm': case 'u': case 'U': case 'V': case 'w':
+	case 'W': case 'x': case 'y': case 'Y':
+		return CLOCK_DAY;
+	}
+	/* seconds (S, T, r, X, c, s) and everything unknown */
+	return CLOCK_SECOND;
+}
+
+/* finest time unit used by strftime format "fmt", the clock is updated
+ * only at the boundaries of that unit
+ */
+static int format_time_unit(const char *fmt)
+{
+	int unit = 0;
+	while (*fmt) {
+		if (*fmt++ != '%')
+			continue;
+
+		/* glibc flags, field width and E/O modifiers */
+		while (*fmt && strchr("_-0^#", *fmt))
+			fmt++;
+		while (*fmt >= '0' && *fmt <= '9')
+			fmt++;
+		if (*fmt == 'E' || *fmt == 'O')
+			fmt++;
+		if (!*fmt)
+			break;
+
+		int u = conversion_unit(*fmt++);
+		if (u && (!unit || u < unit))
+			unit = u;
+	}
+	return unit;
+}
+
+static void schedule_clock_tick(struct widget *w)
+{
+	struct clock_widget *cw = (struct clock_widget*)w->private;
+	if (!cw->unit)
+		return;
+
+	time_t now = time(0);
+	time_t next = now + 1;
+	if (cw->unit != CLOCK_SECOND) {
+		/* local time, hours and days don't start at multiples of
+		 * the unit in every time zone
+		 */
+		struct tm tm;
+		localtime_r(&now, &tm);
+		tm.tm_sec = 0;
+		if (cw->unit == CLOCK_MINUTE) {
+			tm.tm_min++;
+		} else if (cw->unit == CLOCK_HOUR) {
+			tm.tm_min = 0;
+			tm.tm_hour++;
+		} else {
+			tm.tm_min = 0;
+			tm.tm_hour = 0;
+			tm.tm_mday++;
+		}
+		tm.tm_isdst = -1;
+		next = mktime(&tm);
+		if (next <= now)
+			next = now + 1;
+	}
+	if (next > now + CLOCK_MAX_SLEEP)
+		next = now + CLOCK_MAX_SLEEP;
+
+	widget_set_deadline(w, (gint64)next * G_USEC_PER_SEC);
+}
+
+static char find_widest_digit(struct widget *w)
+{
+	struct clock_widget *cw = (struct clock_widget*)w->private;
+	char digit[2] = "0";
+	char widest = '0';
+	int widest_width = -1;
+
+	for (digit[0] = '0'; digit[0] <= '9'; digit[0]++) {
+		int width = 0;
+		text_extents(w->panel->layout, cw->theme.font.pfd,
+			     digit, &width, 0);
+		if (width > widest_width) {
+			widest_width = width;
+			widest = digit[0];
+		}
+	}
+	return widest;
+}
+
+/* Digits are measured as the widest one, so the width doesn't change
+ * (and the panel isn't laid out again) when only the digits do.
+ */
+static int get_clock_width(struct widget *w, const char *buftime)
 {
 	struct clock_widget *cw = (struct clock_widget*)w->private;
 	int text_width = 0;
 	int pics_width = 0;
 
-	char buftime[128];
-	if (!bufover) {
-		fill_buftime(buftime, sizeof(buftime), &cw->theme);
-		bufover = buftime;
+	char shape[128];
+	size_t i;
+	for (i = 0; buftime[i] && i < sizeof(shape) - 1; ++i) {
+		char c = buftime[i];
+		shape[i] = (c >= '0' && c <= '9') ? cw->widest_digit : c;
 	}
+	shape[i] = '\0';
+
 	text_extents(w->panel->layout, cw->theme.font.pfd,
-		     bufover, &text_width, 0);
+		     shape, &text_width, 0);
 	if (cw->theme.background.center) {
 		pics_width += image_width(cw->theme.background.left);
 		pics_width += image_width(cw->theme.background.right);
@@ -91,7 +207,11 @@ static int create_widget_private(struct widget *w, struct config_format_entry *e
 				     &g_settings.root, 1);
 
 	w->private = cw;
-	w->width = get_clock_width(w, 0);
+	cw->unit = format_time_unit(cw->theme.time_format);
+	cw->widest_digit = find_widest_digit(w);
+	fill_buftime(cw->lasttime, sizeof(cw->lasttime), &cw->theme);
+	w->width = get_clock_width(w, cw->lasttime);
+	schedule_clock_tick(w);
 	return 0;
 }
 
@@ -108,10 +228,6 @@ static void draw(struct widget *w)
 {
 	struct clock_widget *cw = (struct clock_widget*)w->private;
 
-	/* time */
-	char buftime[128];
-	fill_buftime(buftime, sizeof(buftime), &cw->theme);
-
 	/* drawing */
 	cairo_t *cr = w->panel->cr;
 	int x = w->x;
@@ -144,7 +260,7 @@ static void draw(struct widget *w)
 	}
 
 	/* text */
-	draw_text(cr, w->panel->layout, &cw->theme.font, buftime,
+	draw_text(cr, w->panel->layout, &cw->theme.font, cw->lasttime,
 		  x, 0, centerw, w->panel->height, 0);
 }
 
@@ -152,15 +268,14 @@ static void clock_tick(struct widget *w)
 {
 	struct clock_widget *cw = (struct clock_widget*)w->private;
 
-	static char buflasttime[128];
 	char buftime[128];
 
-	time_t current_time;
-	current_time = time(0);
-	strftime(buftime, sizeof(buftime), cw->theme.time_format, localtime(&current_time));
-	if (!strcmp(buflasttime, buftime))
+	schedule_clock_tick(w);
+
+	fill_buftime(buftime, sizeof(buftime), &cw->theme);
+	if (!strcmp(cw->lasttime, buftime))
 		return;
-	strcpy(buflasttime, buftime);
+	strcpy(cw->lasttime, buftime);
 
 	int nw = get_clock_width(w, buftime);
 	if (nw != w->width) {
@@ -169,7 +284,14 @@ static void clock_tick(struct widget *w)
 		return;
 	}
 
-	w->needs_expose = 1;
+	/* only the text changes, the side parts of the background stay */
+	int leftw = 0;
+	int rightw = 0;
+	if (cw->theme.background.center) {
+		leftw += image_width(cw->theme.background.left);
+		rightw += image_width(cw->theme.background.right);
+	}
+	widget_damage(w, w->x + leftw, w->width - leftw - rightw);
 }
 
 static void button_click(struct widget *w, XButtonEvent *e)
@@ -12,6 +12,16 @@ static void dnd_drop(struct widget *w, struct drag_info *di);
 
 static void mouse_motion(struct widget *w, XMotionEvent *e);
 static void mouse_leave(struct widget *w);
+static void hot_regions(struct widget *w);
+
+static const int root_props[] = {
+	XATOM_NET_NUMBER_OF_DESKTOPS,
+	XATOM_NET_DESKTOP_NAMES,
+	XATOM_NET_CURRENT_DESKTOP,
+	-1
+};
+
+static const int client_msgs[] = {XATOM_XDND_POSITION, -1};
 
 struct widget_interface desktops_interface = {
 	.theme_name		= "desktop_switcher",
@@ -21,10 +31,13 @@ struct widget_interface desktops_interface = {
 	.draw			= draw,
 	.button_click		= button_click,
 	.prop_change		= prop_change,
+	.root_props		= root_props,
+	.client_msgs		= client_msgs,
 	.dnd_drop		= dnd_drop,
 	.client_msg		= client_msg,
 	.mouse_motion		= mouse_motion,
-	.mouse_leave		= mouse_leave
+	.mouse_leave		= mouse_leave,
+	.hot_regions		= hot_regions
 };
 
 /**************************************************************************
@@ -202,17 +215,35 @@ static void resize_desktops(struct widget *w)
 	w->width = x;
 }
 
-static int get_desktop_at(struct widget *w, int x)
+/* "di" may be -1 or stale, damages the area from the last draw */
+static void damage_desktop(struct widget *w, int di)
+{
+	struct desktops_widget *dw = (struct desktops_widget*)w->private;
+	if (di >= 0 && (size_t)di < dw->desktops_n)
+		widget_damage(w, dw->desktops[di].x, dw->desktops[di].w);
+}
+
+/* desktop positions are updated by draw */
+static void hot_regions(struct widget *w)
 {
 	struct desktops_widget *dw = (struct desktops_widget*)w->private;
 
 	size_t i;
 	for (i = 0; i < dw->desktops_n; ++i) {
 		struct desktops_desktop *d = &dw->desktops[i];
-		if (x < (d->x + d->w) && x > d->x)
-			return (int)i;
+		add_hot_region(w, d->x, d->w, (long)i);
 	}
-	return -1;
+}
+
+static int get_desktop_at(struct widget *w, int x)
+{
+	struct desktops_widget *dw = (struct desktops_widget*)w->private;
+
+	/* desktops could be removed since the last draw */
+	long i = widget_item_at(w, x);
+	if (i < 0 || (size_t)i >= dw->desktops_n)
+		return -1;
+	return (int)i;
 }
 
 /**************************************************************************
@@ -340,8 +371,12 @@ static void prop_change(struct widget *w, XPropertyEvent *e)
 		}
 
 		if (e->atom == c->atoms[XATOM_NET_CURRENT_DESKTOP]) {
+			int old = dw->active;
 			update_active_desktop(dw, c);
-			w->needs_expose = 1;
+			if (old != dw->active) {
+				damage_desktop(w, old);
+				damage_desktop(w, dw->active);
+			}
 			return;
 		}
 	}
@@ -397,8 +432,9 @@ static void mouse_motion(struct widget *w, XMotionEvent *e)
 	struct desktops_widget *dw = (struct desktops_widget*)w->private;
 	int i = get_desktop_at(w, e->x);
 	if (i != dw->highlighted) {
+		damage_desktop(w, dw->highlighted);
+		damage_desktop(w, i);
 		dw->highlighted = i;
-		w->needs_expose = 1;
 	}
 }
 
@@ -406,7 +442,7 @@ static void mouse_leave(struct widget *w)
 {
 	struct desktops_widget *dw = (struct desktops_widget*)w->private;
 	if (dw->highlighted != -1) {
+		damage_desktop(w, dw->highlighted);
 		dw->highlighted = -1;
-		w->needs_expose = 1;
 	}
 }
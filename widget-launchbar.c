@@ -7,6 +7,7 @@ static void destroy_widget_private(struct widget *w);
 static void draw(struct widget *w);
 static void mouse_motion(struct widget *w, XMotionEvent *e);
 static void mouse_leave(struct widget *w);
+static void hot_regions(struct widget *w);
 static void button_click(struct widget *w, XButtonEvent *e);
 static void reconfigure(struct widget *w);
 
@@ -18,19 +19,31 @@ struct widget_interface launchbar_interface = {
 	.draw			= draw,
 	.mouse_motion		= mouse_motion,
 	.mouse_leave		= mouse_leave,
+	.hot_regions		= hot_regions,
 	.button_click		= button_click,
 	.reconfigure		= reconfigure
 };
 
-static int get_item(struct launchbar_widget *lw, int x)
+/* item positions are updated by draw */
+static void hot_regions(struct widget *w)
 {
+	struct launchbar_widget *lw = (struct launchbar_widget*)w->private;
 	size_t i;
-	for (i = 0; i < lw->items_n; ++i) {
-		struct launchbar_item *item = &lw->items[i];
-		if (item->x < x && (item->x + item->w) > x)
-			return (int)i;
-	}
-	return -1;
+	for (i = 0; i < lw->items_n; ++i)
+		add_hot_region(w, lw->items[i].x, lw->items[i].w, (long)i);
+}
+
+static int get_item(struct widget *w, int x)
+{
+	return (int)widget_item_at(w, x);
+}
+
+/* "i" may be -1, damages the area from the last draw */
+static void damage_item(struct widget *w, int i)
+{
+	struct launchbar_widget *lw = (struct launchbar_widget*)w->private;
+	if (i >= 0 && (size_t)i < lw->items_n)
+		widget_damage(w, lw->items[i].x, lw->items[i].w);
 }
 
 static int parse_items(struct launchbar_widget *lw)
@@ -211,10 +224,11 @@ static void draw(struct widget *w)
 static void mouse_motion(struct widget *w, XMotionEvent *e)
 {
 	struct launchbar_widget *lw = (struct launchbar_widget*)w->private;
-	int cur = get_item(lw, e->x);
+	int cur = get_item(w, e->x);
 	if (cur != lw->active) {
+		damage_item(w, lw->active);
+		damage_item(w, cur);
 		lw->active = cur;
-		w->needs_expose = 1;
 	}
 }
 
@@ -222,15 +236,15 @@ static void mouse_leave(struct widget *w)
 {
 	struct launchbar_widget *lw = (struct launchbar_widget*)w->private;
 	if (lw->active != -1) {
+		damage_item(w, lw->active);
 		lw->active = -1;
-		w->needs_expose = 1;
 	}
 }
 
 static void button_click(struct widget *w, XButtonEvent *e)
 {
 	struct launchbar_widget *lw = (struct launchbar_widget*)w->private;
-	int cur = get_item(lw, e->x);
+	int cur = get_item(w, e->x);
 	if (cur == -1)
 		return;
 
@@ -15,8 +15,27 @@ static void dnd_drop(struct widget *w, struct drag_info *di);
 static void configure(struct widget *w, XConfigureEvent *e);
 static void mouse_motion(struct widget *w, XMotionEvent *e);
 static void mouse_leave(struct widget *w);
+static void hot_regions(struct widget *w);
 static void reconfigure(struct widget *w);
 
+static const int root_props[] = {
+	XATOM_NET_NUMBER_OF_DESKTOPS,
+	XATOM_NET_WORKAREA,
+	XATOM_NET_ACTIVE_WINDOW,
+	XATOM_NET_CURRENT_DESKTOP,
+	XATOM_NET_CLIENT_LIST_STACKING,
+	-1
+};
+
+static const int window_props[] = {
+	XATOM_NET_WM_DESKTOP,
+	XATOM_NET_WM_STATE,
+	XATOM_NET_FRAME_EXTENTS,
+	-1
+};
+
+static const int client_msgs[] = {XATOM_XDND_POSITION, -1};
+
 struct widget_interface pager_interface = {
 	.theme_name		= "pager",
 	.size_type		= WIDGET_SIZE_CONSTANT,
@@ -25,11 +44,15 @@ struct widget_interface pager_interface = {
 	.draw			= draw,
 	.button_click		= button_click,
 	.prop_change		= prop_change,
+	.root_props		= root_props,
+	.window_props		= window_props,
+	.client_msgs		= client_msgs,
 	.dnd_drop		= dnd_drop,
 	.client_msg		= client_msg,
 	.configure		= configure,
 	.mouse_motion		= mouse_motion,
 	.mouse_leave		= mouse_leave,
+	.hot_regions		= hot_regions,
 	.reconfigure		= reconfigure
 };
 
@@ -124,21 +147,16 @@ static gboolean task_remove_all(Window *win, struct pager_task *t, void *notused
 	return 1;
 }
 
+/* frame included, geometry is tracked (see x_track_window) */
 static void get_window_position(struct x_connection *c, struct pager_task *t, Window win)
 {
-	XWindowAttributes winattrs;
-	XGetWindowAttributes(c->dpy, win, &winattrs);
-	t->w = winattrs.width;
-	t->h = winattrs.height;
-	x_translate_coordinates(c, 0, 0, &t->x, &t->y, win);
-
-	long *extents = x_get_prop_data(c, win, c->atoms[XATOM_NET_FRAME_EXTENTS],
-					XA_CARDINAL, 0);
-	if (extents) {
-		t->x -= extents[0]; t->w += extents[0] + extents[1];
-		t->y -= extents[2]; t->h += extents[2] + extents[3];
-		XFree(extents);
-	}
+	const struct x_window_geometry *g = x_track_window(c, win);
+	const long *extents = g->frame;
+
+	t->x = g->x - extents[0];
+	t->y = g->y - extents[2];
+	t->w = g->w + extents[0] + extents[1];
+	t->h = g->h + extents[2] + extents[3];
 }
 
 static void select_window_input(struct x_connection *c, Window win)
@@ -164,6 +182,13 @@ static int update_tasks(struct widget *w)
 	int needs_expose = 0;
 	size_t i;
 	struct pager_task *t;
+
+	/* new windows, their state is fetched at once */
+	struct x_window_state *states =
+		xmalloc(sizeof(struct x_window_state) * pw->windows_n);
+	int *states_pos = xmalloc(sizeof(int) * pw->windows_n);
+	size_t states_n = 0;
+
 	for (i = 0; i < pw->windows_n; ++i) {
 		Window win = pw->windows[i];
 		t = g_hash_table_lookup(pw->tasks, &win);
@@ -174,21 +199,30 @@ static int update_tasks(struct widget *w)
 				needs_expose = 1;
 			}
 		} else {
-			t = xmallocz(sizeof(struct pager_task));
-			select_window_input(c, win);
-			get_window_position(c, t, win);
-			t->win = win;
-			t->alive = 1;
-			t->desktop = x_get_window_desktop(c, win);
-			t->visible = x_is_window_visible_on_screen(c, win);
-			t->visible_on_panel = x_is_window_visible_on_panel(c, win);
-			t->stackpos = i;
-
-			g_hash_table_insert(pw->tasks, &t->win, t);
-			needs_expose = 1;
+			states_pos[states_n] = i;
+			states[states_n++].win = win;
 		}
 	}
 
+	x_get_window_states(c, states, states_n);
+	for (i = 0; i < states_n; ++i) {
+		Window win = states[i].win;
+		t = xmallocz(sizeof(struct pager_task));
+		select_window_input(c, win);
+		get_window_position(c, t, win);
+		t->win = win;
+		t->alive = 1;
+		t->desktop = states[i].desktop;
+		t->visible = states[i].visible_on_screen;
+		t->visible_on_panel = states[i].visible_on_panel;
+		t->stackpos = states_pos[i];
+
+		g_hash_table_insert(pw->tasks, &t->win, t);
+		needs_expose = 1;
+	}
+	xfree(states);
+	xfree(states_pos);
+
 	g_hash_table_foreach_remove(pw->tasks, (GHRFunc)task_remove_dead, 0);
 	return needs_expose;
 }
@@ -287,17 +321,35 @@ static void resize_desktops(struct widget *w)
 	w->width = width + (pw->desktops_n - 1) * pw->theme.desktop_spacing;
 }
 
-static int get_desktop_at(struct widget *w, int x)
+/* "di" may be -1 or stale, damages the area from the last draw */
+static void damage_desktop(struct widget *w, int di)
+{
+	struct pager_widget *pw = (struct pager_widget*)w->private;
+	if (di >= 0 && (size_t)di < pw->desktops_n)
+		widget_damage(w, pw->desktops[di].x, pw->desktops[di].w);
+}
+
+/* desktop positions are updated by draw */
+static void hot_regions(struct widget *w)
 {
 	struct pager_widget *pw = (struct pager_widget*)w->private;
 
 	size_t i;
 	for (i = 0; i < pw->desktops_n; ++i) {
 		struct pager_desktop *d = &pw->desktops[i];
-		if (x < (d->x + d->w) && x > d->x)
-			return (int)i;
+		add_hot_region(w, d->x, d->w, (long)i);
 	}
-	return -1;
+}
+
+static int get_desktop_at(struct widget *w, int x)
+{
+	struct pager_widget *pw = (struct pager_widget*)w->private;
+
+	/* desktops could be removed since the last draw */
+	long i = widget_item_at(w, x);
+	if (i < 0 || (size_t)i >= pw->desktops_n)
+		return -1;
+	return (int)i;
 }
 
 /**************************************************************************
@@ -462,8 +514,12 @@ static void prop_change(struct widget *w, XPropertyEvent *e)
 		}
 
 		if (e->atom == c->atoms[XATOM_NET_CURRENT_DESKTOP]) {
+			int old = pw->active;
 			update_active_desktop(pw, c);
-			w->needs_expose = 1;
+			if (old != pw->active) {
+				damage_desktop(w, old);
+				damage_desktop(w, pw->active);
+			}
 			return;
 		}
 
@@ -480,14 +536,22 @@ static void prop_change(struct widget *w, XPropertyEvent *e)
 		return;
 
 	if (e->atom == c->atoms[XATOM_NET_WM_DESKTOP]) {
+		int old = t->desktop;
 		t->desktop = x_get_window_desktop(c, t->win);
-		w->needs_expose = 1;
+		if (old == -1 || t->desktop == -1) {
+			w->needs_expose = 1;
+		} else if (old != t->desktop) {
+			damage_desktop(w, old);
+			damage_desktop(w, t->desktop);
+		}
 		return;
 	}
 
 	if (e->atom == c->atoms[XATOM_NET_WM_STATE]) {
-		t->visible = x_is_window_visible_on_screen(c, t->win);
-		t->visible_on_panel = x_is_window_visible_on_panel(c, t->win);
+		struct x_window_state st = {t->win};
+		x_get_window_states(c, &st, 1);
+		t->visible = st.visible_on_screen;
+		t->visible_on_panel = st.visible_on_panel;
 		w->needs_expose = 1;
 		return;
 	}
@@ -552,8 +616,10 @@ static void configure(struct widget *w, XConfigureEvent *e)
 	if (!t)
 		return;
 
+	struct pager_task old = *t;
 	get_window_position(c, t, e->window);
-	w->needs_expose = 1;
+	if (old.x != t->x || old.y != t->y || old.w != t->w || old.h != t->h)
+		w->needs_expose = 1;
 }
 
 static void mouse_motion(struct widget *w, XMotionEvent *e)
@@ -561,8 +627,9 @@ static void mouse_motion(struct widget *w, XMotionEvent *e)
 	struct pager_widget *pw = (struct pager_widget*)w->private;
 	int i = get_desktop_at(w, e->x);
 	if (i != pw->highlighted) {
+		damage_desktop(w, pw->highlighted);
+		damage_desktop(w, i);
 		pw->highlighted = i;
-		w->needs_expose = 1;
 	}
 }
 
@@ -570,8 +637,8 @@ static void mouse_leave(struct widget *w)
 {
 	struct pager_widget *pw = (struct pager_widget*)w->private;
 	if (pw->highlighted != -1) {
+		damage_desktop(w, pw->highlighted);
 		pw->highlighted = -1;
-		w->needs_expose = 1;
 	}
 }
 
@@ -11,12 +11,15 @@ static void draw(struct widget *w);
 static int retheme_reconfigure(struct widget *w, struct config_format_entry *e,
 			       struct config_format_tree *tree);
 
+static const int client_msgs[] = {XATOM_NET_SYSTEM_TRAY_OPCODE, -1};
+
 struct widget_interface systray_interface = {
 	.theme_name		= "systray",
 	.size_type		= WIDGET_SIZE_CONSTANT,
 	.create_widget_private	= create_widget_private,
 	.destroy_widget_private = destroy_widget_private,
 	.client_msg		= client_msg,
+	.client_msgs		= client_msgs,
 	.win_destroy		= win_destroy,
 	.configure		= configure,
 	.draw			= draw,
@@ -57,9 +60,14 @@ static void add_tray_icon(struct widget *w, Window win)
 	icon.icon = win;
 
 	/* create embedder window */
-	icon.embedder = x_create_default_embedder(c, w->panel->win, win,
-						  st->icon_size[0],
-						  st->icon_size[1]);
+	if (w->panel->render->argb)
+		icon.embedder = x_create_argb_embedder(c, w->panel->win, win,
+						       st->icon_size[0],
+						       st->icon_size[1]);
+	else
+		icon.embedder = x_create_default_embedder(c, w->panel->win, win,
+							  st->icon_size[0],
+							  st->icon_size[1]);
 
 	/* Select structure notifications. Some tray icons require double
 	 * size sets (I don't know why, but it works).
@@ -182,8 +190,10 @@ static int create_widget_private(struct widget *w, struct config_format_entry *e
 
 	x_set_prop_int(c, sw->selection_owner, orientatom,
 		       NET_SYSTEM_TRAY_ORIENTATION_HORZ);
+	Visual *visual = w->panel->render->argb ? c->argb_visual :
+						   c->default_visual;
 	x_set_prop_visualid(c, sw->selection_owner, visualatom,
-			    XVisualIDFromVisual(c->default_visual));
+			    XVisualIDFromVisual(visual));
 
 	/* inform other clients that we're here */
 	XEvent ev;
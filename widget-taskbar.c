@@ -17,10 +17,39 @@ static void dnd_drop(struct widget *w, struct drag_info *di);
 
 static void mouse_motion(struct widget *w, XMotionEvent *e);
 static void mouse_leave(struct widget *w);
+static void hot_regions(struct widget *w);
 
 static void clock_tick(struct widget *w);
 static void reconfigure(struct widget *w);
 
+static void invalidate_task_cache(struct taskbar_task *t);
+
+static const int root_props[] = {
+	XATOM_NET_ACTIVE_WINDOW,
+	XATOM_NET_CURRENT_DESKTOP,
+	XATOM_NET_CLIENT_LIST,
+	-1
+};
+
+static const int window_props[] = {
+	XATOM_NET_WM_STATE,
+	XATOM_WM_STATE,
+	XATOM_NET_WM_WINDOW_TYPE,
+	XATOM_NET_WM_DESKTOP,
+	/* name sources, must match get_name_sources in xutil.c */
+	XATOM_NET_WM_VISIBLE_ICON_NAME,
+	XATOM_NET_WM_ICON_NAME,
+	XATOM_WM_ICON_NAME,
+	XATOM_NET_WM_VISIBLE_NAME,
+	XATOM_NET_WM_NAME,
+	XATOM_WM_NAME,
+	XATOM_NET_WM_ICON,
+	XATOM_WM_HINTS,
+	-1
+};
+
+static const int client_msgs[] = {XATOM_XDND_POSITION, -1};
+
 struct widget_interface taskbar_interface = {
 	.theme_name		= "taskbar",
 	.size_type		= WIDGET_SIZE_FILL,
@@ -29,6 +58,9 @@ struct widget_interface taskbar_interface = {
 	.draw			= draw,
 	.button_click		= button_click,
 	.prop_change		= prop_change,
+	.root_props		= root_props,
+	.window_props		= window_props,
+	.client_msgs		= client_msgs,
 	.dnd_start		= dnd_start,
 	.dnd_drag		= dnd_drag,
 	.dnd_drop		= dnd_drop,
@@ -36,6 +68,7 @@ struct widget_interface taskbar_interface = {
 	.configure		= configure,
 	.mouse_motion		= mouse_motion,
 	.mouse_leave		= mouse_leave,
+	.hot_regions		= hot_regions,
 	.clock_tick		= clock_tick,
 	.reconfigure		= reconfigure
 };
@@ -183,14 +216,24 @@ static int task_monitor(int x, int y, int w, int h,
 	return task_monitor;
 }
 
-static int find_task_by_window(struct taskbar_widget *tw, Window win)
+/* Index stores "i + 1" (zero means "not found" for GHashTable), it should
+ * be updated after each change of task array, starting from the first
+ * moved element. Layout refers to tasks by index too.
+ */
+static void reindex_tasks(struct taskbar_widget *tw, size_t from)
 {
 	size_t i;
-	for (i = 0; i < tw->tasks_n; ++i) {
-		if (tw->tasks[i].win == win)
-			return (int)i;
-	}
-	return -1;
+	tw->layout_dirty = 1;
+	for (i = from; i < tw->tasks_n; ++i)
+		g_hash_table_insert(tw->tasks_index,
+				    GUINT_TO_POINTER(tw->tasks[i].win),
+				    GUINT_TO_POINTER(i + 1));
+}
+
+static int find_task_by_window(struct taskbar_widget *tw, Window win)
+{
+	gpointer i = g_hash_table_lookup(tw->tasks_index, GUINT_TO_POINTER(win));
+	return (int)GPOINTER_TO_UINT(i) - 1;
 }
 
 static int find_last_task_by_desktop(struct taskbar_widget *tw, int desktop)
@@ -204,48 +247,138 @@ static int find_last_task_by_desktop(struct taskbar_widget *tw, int desktop)
 	return t;
 }
 
-static void add_task(struct widget *w, struct x_connection *c, Window win)
+/* Ticks fetch details of new tasks (as soon as possible) and blink urgent
+ * tasks (every second), the timer is armed only while there is work.
+ */
+static void schedule_tick(struct widget *w)
 {
 	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
-	struct taskbar_task t;
+	int blink = 0;
 
-	x_set_error_trap();
-	if (!x_is_window_visible_on_panel(c, win)) {
-		if (x_done_error_trap())
+	size_t i;
+	for (i = 0; i < tw->tasks_n; ++i) {
+		struct taskbar_task *t = &tw->tasks[i];
+		if (t->pending) {
+			widget_set_deadline(w, g_get_real_time());
 			return;
-		// we need this if window will apear later
-		if (w->panel->win != win)
-			XSelectInput(c->dpy, win, PropertyChangeMask);
-		return;
+		}
+		if (tw->task_urgency_hint && t->demands_attention > 0)
+			blink = 1;
+	}
+
+	if (blink) {
+		gint64 now = g_get_real_time();
+		widget_set_deadline(w, (now / G_USEC_PER_SEC + 1) * G_USEC_PER_SEC);
+	}
+}
+
+/* Adding tasks is done in two phases. Everything needed to show a task
+ * (state and name) is fetched for all new windows at once, "states" are
+ * prefetched (see x_get_window_states). Geometry and icon cost several
+ * round trips per window, they are fetched later in small batches (see
+ * fetch_pending_tasks), meanwhile tasks are shown with the default icon.
+ */
+static void add_tasks(struct widget *w, struct x_connection *c,
+		      const struct x_window_state *states, size_t n)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	struct taskbar_task *tasks = xmallocz(sizeof(struct taskbar_task) * n);
+	struct x_window_name *names = xmalloc(sizeof(struct x_window_name) * n);
+	size_t tasks_n = 0;
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		const struct x_window_state *st = &states[i];
+		if (!st->visible_on_panel) {
+			// we need this if window will apear later
+			if (w->panel->win != st->win)
+				XSelectInput(c->dpy, st->win, PropertyChangeMask);
+			continue;
+		}
+
+		/* the same set the pager selects, no need to merge with
+		 * the current one
+		 */
+		XSelectInput(c->dpy, st->win,
+			     PropertyChangeMask | StructureNotifyMask);
+
+		struct taskbar_task *t = &tasks[tasks_n];
+		t->win = st->win;
+		t->desktop = st->desktop;
+		t->demands_attention = st->demands_attention;
+		t->monitor = w->panel->monitor;
+		t->pending = 1;
+		if (tw->theme.default_icon) {
+			t->icon = tw->theme.default_icon;
+			cairo_surface_reference(t->icon);
+		}
+
+		names[tasks_n].win = t->win;
+		names[tasks_n].name = &t->name;
+		tasks_n++;
 	}
+	x_get_window_names(c, names, tasks_n);
 
+	size_t reindex_from = tw->tasks_n;
+	for (i = 0; i < tasks_n; ++i) {
+		struct taskbar_task *t = &tasks[i];
+		t->name_atom = names[i].atom;
+		t->name_type_atom = names[i].type;
 
-	XWindowAttributes winattrs;
-	XGetWindowAttributes(c->dpy, win, &winattrs);
-	long mask = winattrs.your_event_mask | PropertyChangeMask | StructureNotifyMask;
-	XSelectInput(c->dpy, win, mask);
-	XGetWindowAttributes(c->dpy, win, &winattrs); /* get position after select input */
+		int after = find_last_task_by_desktop(tw, t->desktop);
+		if (after == -1)
+			ARRAY_PREPEND(tw->tasks, *t);
+		else
+			ARRAY_INSERT_AFTER(tw->tasks, (size_t)after, *t);
+		if ((size_t)(after + 1) < reindex_from)
+			reindex_from = (size_t)(after + 1);
+	}
+	if (tasks_n) {
+		reindex_tasks(tw, reindex_from);
+		schedule_tick(w);
+		w->needs_expose = 1;
+	}
 
-	CLEAR_STRUCT(&t);
-	t.win = win;
-	t.demands_attention = x_is_window_demands_attention(c, win);
-	int x, y;
-	x_translate_coordinates(c, 0, 0, &x, &y, win);
-	t.monitor = task_monitor(x, y, winattrs.width, winattrs.height,
-				 c->monitors, c->monitors_n);
+	xfree(names);
+	xfree(tasks);
+}
 
-	x_realloc_window_name(&t.name, c, win, &t.name_atom, &t.name_type_atom);
-	if (tw->theme.default_icon)
-		t.icon = get_window_icon(c, win, tw->theme.default_icon);
-	else
-		t.icon = 0;
-	t.desktop = x_get_window_desktop(c, win);
+#define TASKBAR_FETCH_BATCH 8
 
-	int i = find_last_task_by_desktop(tw, t.desktop);
-	if (i == -1)
-		ARRAY_PREPEND(tw->tasks, t);
-	else
-		ARRAY_INSERT_AFTER(tw->tasks, (size_t)i, t);
+/* the second phase of adding tasks (see add_tasks) */
+static void fetch_pending_tasks(struct widget *w)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	struct x_connection *c = &w->panel->connection;
+	int fetched = 0;
+
+	size_t i;
+	for (i = 0; i < tw->tasks_n && fetched < TASKBAR_FETCH_BATCH; ++i) {
+		struct taskbar_task *t = &tw->tasks[i];
+		if (!t->pending)
+			continue;
+		t->pending = 0;
+		fetched++;
+
+		/* input was selected in add_tasks */
+		const struct x_window_geometry *g = x_track_window(c, t->win);
+		t->monitor = task_monitor(g->x, g->y, g->w, g->h,
+					  c->monitors, c->monitors_n);
+
+		if (tw->theme.default_icon) {
+			cairo_surface_t *icon = get_window_icon(c, t->win,
+								tw->theme.default_icon);
+			cairo_surface_destroy(t->icon);
+			t->icon = icon;
+		}
+		invalidate_task_cache(t);
+	}
+
+	/* monitors could change */
+	if (fetched) {
+		tw->layout_dirty = 1;
+		w->needs_expose = 1;
+	}
 }
 
 static void free_task(struct taskbar_task *t)
@@ -253,12 +386,16 @@ static void free_task(struct taskbar_task *t)
 	strbuf_free(&t->name);
 	if (t->icon)
 		cairo_surface_destroy(t->icon);
+	if (t->cache)
+		cairo_surface_destroy(t->cache);
 }
 
 static void remove_task(struct taskbar_widget *tw, size_t i)
 {
+	g_hash_table_remove(tw->tasks_index, GUINT_TO_POINTER(tw->tasks[i].win));
 	free_task(&tw->tasks[i]);
 	ARRAY_REMOVE(tw->tasks, i);
+	reindex_tasks(tw, i);
 }
 
 static void free_tasks(struct taskbar_widget *tw)
@@ -267,18 +404,86 @@ static void free_tasks(struct taskbar_widget *tw)
 	for (i = 0; i < tw->tasks_n; ++i)
 		free_task(&tw->tasks[i]);
 	FREE_ARRAY(tw->tasks);
+	g_hash_table_destroy(tw->tasks_index);
 }
 
-static int count_visible_tasks(struct widget *w)
+/**************************************************************************
+  Taskbar layout
+**************************************************************************/
+
+/* Task positions depend only on the set of visible tasks and the widget
+ * geometry, so they are computed here (without any drawing) and reused by
+ * drawing and hit testing until something of that changes.
+ */
+static void layout_tasks(struct widget *w)
 {
 	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
-	int count = 0;
+	struct panel *p = w->panel;
+	struct x_connection *c = &p->connection;
+
+	int key[5] = {w->x, w->width, p->x, p->y, p->height};
+	if (!tw->layout_dirty && !memcmp(key, tw->layout_key, sizeof(key)))
+		return;
+	memcpy(tw->layout_key, key, sizeof(key));
+	tw->layout_dirty = 0;
+
+	/* visible tasks */
+	CLEAR_ARRAY(tw->slots);
+	ENSURE_ARRAY_CAPACITY(tw->slots, tw->tasks_n);
 	size_t i;
 	for (i = 0; i < tw->tasks_n; ++i) {
 		if (is_task_visible(w, &tw->tasks[i]))
-			count++;
+			tw->slots[tw->slots_n++].task = (int)i;
+	}
+
+	int count = (int)tw->slots_n;
+	if (!count)
+		return;
+
+	int sepw = image_width(tw->theme.separator);
+	int sepspace = (count-1) * sepw;
+	int taskw = (w->width - sepspace) / count;
+	if (tw->theme.task_max_width && taskw > tw->theme.task_max_width)
+		taskw = tw->theme.task_max_width;
+
+	int x = w->x;
+	int geom_dirty = 0;
+
+	for (i = 0; i < tw->slots_n; ++i) {
+		struct taskbar_slot *s = &tw->slots[i];
+		struct taskbar_task *t = &tw->tasks[s->task];
+
+#define TASKS_NEED_CORRECTION (taskw != tw->theme.task_max_width)
+		/* last task width correction */
+		if (TASKS_NEED_CORRECTION && i == tw->slots_n - 1)
+			taskw = (w->x + w->width) - x;
+
+		s->x = t->x = x;
+		s->w = t->w = taskw;
+
+		/* icon geometry, published after the layout is done */
+		long geom[4] = {p->x + t->x, p->y, t->w, p->height};
+		if (memcmp(t->geom, geom, sizeof(geom))) {
+			memcpy(t->geom, geom, sizeof(geom));
+			t->geom_dirty = 1;
+			geom_dirty = 1;
+		}
+
+		x += taskw + sepw;
+	}
+
+	/* only changed geometries, otherwise each layout would cause
+	 * property traffic for every task
+	 */
+	for (i = 0; geom_dirty && i < tw->tasks_n; ++i) {
+		struct taskbar_task *t = &tw->tasks[i];
+		if (!t->geom_dirty)
+			continue;
+
+		x_set_prop_array(c, t->win, c->atoms[XATOM_NET_WM_ICON_GEOMETRY],
+				 t->geom, 4);
+		t->geom_dirty = 0;
 	}
-	return count;
 }
 
 static int highlighted_state_exists(struct taskbar_theme *theme, int active)
@@ -289,9 +494,9 @@ static int highlighted_state_exists(struct taskbar_theme *theme, int active)
 	return 0;
 }
 
-static void draw_task(struct taskbar_task *task, struct taskbar_widget *tw,
-		cairo_t *cr, PangoLayout *layout, int x, int w, int active,
-		int highlighted)
+/* returns the index of the theme state used for the task */
+static int task_state(struct taskbar_task *task, struct taskbar_widget *tw,
+		      int active, int highlighted)
 {
 	struct taskbar_theme *theme = &tw->theme;
 
@@ -307,22 +512,20 @@ static void draw_task(struct taskbar_task *task, struct taskbar_widget *tw,
 		}
 	}
 
-	/* calculations */
 	int state = active << 1;
 	int state_hl = (active << 1) | highlighted;
+	if (theme->states[state_hl].exists)
+		return state_hl;
+	return state;
+}
 
-	struct triple_image *tbt;
-	struct text_info *font;
-	int *icon_offset;
-	if (theme->states[state_hl].exists) {
-		tbt = &theme->states[state_hl].background;
-		font = &theme->states[state_hl].font;
-		icon_offset = theme->states[state_hl].icon_offset;
-	} else {
-		tbt = &theme->states[state].background;
-		font = &theme->states[state].font;
-		icon_offset = theme->states[state].icon_offset;
-	}
+static void paint_task(struct taskbar_task *task, struct taskbar_theme *theme,
+		cairo_t *cr, PangoLayout *layout, int x, int w, int state)
+{
+	/* calculations */
+	struct triple_image *tbt = &theme->states[state].background;
+	struct text_info *font = &theme->states[state].font;
+	int *icon_offset = theme->states[state].icon_offset;
 
 	int leftw = image_width(tbt->left);
 	int rightw = image_width(tbt->right);
@@ -334,23 +537,8 @@ static void draw_task(struct taskbar_task *task, struct taskbar_widget *tw,
 	int textw = centerw - (iconw + icon_offset[0]);
 
 	/* background */
-	int leftx = x;
 	int centerx = x + leftw;
-	int rightx = centerx + centerw;
-
-	if (tbt->stretched_overlap)
-		stretch_image(tbt->center, cr,
-			      leftx + tbt->center_offsets[0], 0,
-			      w - tbt->center_offsets[0] - tbt->center_offsets[1]);
-	else if (tbt->stretched)
-		stretch_image(tbt->center, cr,
-			      centerx + tbt->center_offsets[0], 0,
-			      centerw - tbt->center_offsets[0] - tbt->center_offsets[1]);
-	else
-		pattern_image(tbt->center, cr, centerx, 0, centerw, 1);
-
-	if (leftw) blit_image(tbt->left, cr, leftx, 0);
-	if (rightw) blit_image(tbt->right, cr, rightx, 0);
+	draw_triple_image(tbt, cr, x, 0, w);
 
 	/* icon */
 	int xx = centerx;
@@ -369,6 +557,42 @@ static void draw_task(struct taskbar_task *task, struct taskbar_widget *tw,
 	draw_text(cr, layout, font, task->name.buf, xx, 0, textw, height, 1);
 }
 
+/* task contents are rendered once into a cached surface, the cache is
+ * valid while task width, state, name and icon stay the same
+ */
+static void draw_task(struct taskbar_task *task, struct taskbar_widget *tw,
+		cairo_t *cr, PangoLayout *layout, int x, int w, int active,
+		int highlighted)
+{
+	struct taskbar_theme *theme = &tw->theme;
+	int state = task_state(task, tw, active, highlighted);
+
+	if (!task->cache || task->cache_w != w || task->cache_state != state) {
+		int height = image_height(theme->states[state].background.center);
+		if (task->cache)
+			cairo_surface_destroy(task->cache);
+		task->cache = cairo_surface_create_similar(cairo_get_target(cr),
+				CAIRO_CONTENT_COLOR_ALPHA, w, height);
+		task->cache_w = w;
+		task->cache_state = state;
+
+		cairo_t *ccr = cairo_create(task->cache);
+		cairo_set_operator(ccr, cairo_get_operator(cr));
+		paint_task(task, theme, ccr, layout, 0, w, state);
+		cairo_destroy(ccr);
+	}
+
+	blit_image(task->cache, cr, x, 0);
+}
+
+static void invalidate_task_cache(struct taskbar_task *t)
+{
+	if (t->cache) {
+		cairo_surface_destroy(t->cache);
+		t->cache = 0;
+	}
+}
+
 static inline void activate_task(struct x_connection *c, struct taskbar_task *t)
 {
 	x_send_netwm_message(c, t->win, c->atoms[XATOM_NET_ACTIVE_WINDOW],
@@ -394,25 +618,33 @@ static void move_task(struct taskbar_widget *tw, int what, int where)
 	if (where > what) {
 		where -= 1;
 		ARRAY_INSERT_AFTER(tw->tasks, (size_t)where, t);
+		reindex_tasks(tw, (size_t)what);
 	} else {
 		ARRAY_INSERT_BEFORE(tw->tasks, (size_t)where, t);
+		reindex_tasks(tw, (size_t)where);
 	}
 }
 
-static int get_taskbar_task_at(struct widget *w, int x)
+/* items are windows, task indices change on every reindex_tasks */
+static void hot_regions(struct widget *w)
 {
 	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	layout_tasks(w);
 
 	size_t i;
-	for (i = 0; i < tw->tasks_n; ++i) {
-		struct taskbar_task *t = &tw->tasks[i];
-		if (!is_task_visible(w, t))
-			continue;
-
-		if (x < (t->x + t->w) && x > t->x)
-			return (int)i;
+	for (i = 0; i < tw->slots_n; ++i) {
+		struct taskbar_slot *s = &tw->slots[i];
+		add_hot_region(w, s->x, s->w, (long)tw->tasks[s->task].win);
 	}
-	return -1;
+}
+
+static int get_taskbar_task_at(struct widget *w, int x)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	long win = widget_item_at(w, x);
+	if (win == -1)
+		return -1;
+	return find_task_by_window(tw, (Window)win);
 }
 
 /**************************************************************************
@@ -429,6 +661,7 @@ static void update_desktop(struct taskbar_widget *tw, struct x_connection *c)
 {
 	tw->desktop = x_get_prop_int(c, c->root,
 			c->atoms[XATOM_NET_CURRENT_DESKTOP]);
+	tw->layout_dirty = 1;
 }
 
 static void update_tasks(struct widget *w, struct x_connection *c)
@@ -439,28 +672,48 @@ static void update_tasks(struct widget *w, struct x_connection *c)
 
 	wins = x_get_prop_data(c, c->root, c->atoms[XATOM_NET_CLIENT_LIST],
 			XA_WINDOW, &num);
+	if (!wins)
+		num = 0;
 
+	GHashTable *clients = g_hash_table_new(g_direct_hash, g_direct_equal);
 	size_t i;
 	int j;
+	for (j = 0; j < num; ++j)
+		g_hash_table_insert(clients, GUINT_TO_POINTER(wins[j]),
+				    GUINT_TO_POINTER(1));
+
+	/* remove dead tasks, keeping the order of alive ones */
+	size_t alive = 0;
 	for (i = 0; i < tw->tasks_n; ++i) {
 		struct taskbar_task *t = &tw->tasks[i];
-		int delete = 1;
-		for (j = 0; j < num; ++j) {
-			if (wins[j] == t->win) {
-				delete = 0;
-				break;
-			}
+		if (g_hash_table_lookup(clients, GUINT_TO_POINTER(t->win))) {
+			tw->tasks[alive++] = *t;
+		} else {
+			g_hash_table_remove(tw->tasks_index,
+					    GUINT_TO_POINTER(t->win));
+			free_task(t);
 		}
-		if (delete)
-			remove_task(tw, i--);
 	}
+	if (alive != tw->tasks_n) {
+		tw->tasks_n = alive;
+		reindex_tasks(tw, 0);
+	}
+	g_hash_table_destroy(clients);
 
+	/* fetch state of all new windows at once */
+	struct x_window_state *states = xmalloc(sizeof(struct x_window_state) * num);
+	int states_n = 0;
 	for (j = 0; j < num; ++j) {
 		if (find_task_by_window(tw, wins[j]) == -1)
-			add_task(w, c, wins[j]);
+			states[states_n++].win = wins[j];
 	}
+	x_get_window_states(c, states, states_n);
+
+	add_tasks(w, c, states, states_n);
 
-	XFree(wins);
+	xfree(states);
+	if (wins)
+		XFree(wins);
 }
 
 /**************************************************************************
@@ -478,6 +731,9 @@ static int create_widget_private(struct widget *w, struct config_format_entry *e
 	}
 
 	INIT_ARRAY(tw->tasks, 50);
+	INIT_ARRAY(tw->slots, 50);
+	tw->layout_dirty = 1;
+	tw->tasks_index = g_hash_table_new(g_direct_hash, g_direct_equal);
 	w->private = tw;
 
 	struct x_connection *c = &w->panel->connection;
@@ -504,74 +760,52 @@ static void destroy_widget_private(struct widget *w)
 	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
 	free_taskbar_theme(&tw->theme);
 	free_tasks(tw);
+	FREE_ARRAY(tw->slots);
 	XFreeCursor(w->panel->connection.dpy, tw->dnd_cur);
 	xfree(tw);
 }
 
 static void draw(struct widget *w)
 {
-	/* I think it's a good idea to calculate all buttons positions here, and
-	 * cache these data for later use in other message handlers. User
-	 * interacts with what he/she sees, right?
-	 */
 	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
-	struct panel *p = w->panel;
-	struct x_connection *c = &p->connection;
-	cairo_t *cr = p->cr;
+	cairo_t *cr = w->panel->cr;
+	int sepw = image_width(tw->theme.separator);
 
-	int count = count_visible_tasks(w);
-	if (!count)
-		return;
-
-	int sepspace = (count-1) * image_width(tw->theme.separator);
-	int taskw = (w->width - sepspace) / count;
-	if (tw->theme.task_max_width && taskw > tw->theme.task_max_width)
-		taskw = tw->theme.task_max_width;
+	layout_tasks(w);
 
-	int x = w->x;
-	int curtask = 0;
 	size_t i;
+	for (i = 0; i < tw->slots_n; ++i) {
+		struct taskbar_slot *s = &tw->slots[i];
+		struct taskbar_task *t = &tw->tasks[s->task];
+
+		draw_task(t, tw, cr, w->panel->layout, s->x, s->w,
+			  t->win == tw->active, s->task == tw->highlighted);
+		if (sepw && i != tw->slots_n - 1)
+			blit_image(tw->theme.separator, cr, s->x + s->w, 0);
+	}
+}
 
-	for (i = 0; i < tw->tasks_n; ++i) {
-		struct taskbar_task *t = &tw->tasks[i];
-
-		if (!is_task_visible(w, t))
-			continue;
-
-#define TASKS_NEED_CORRECTION (taskw != tw->theme.task_max_width)
-		/* last task width correction */
-		if (TASKS_NEED_CORRECTION && curtask == count-1)
-			taskw = (w->x + w->width) - x;
-
-		/* save position for other events */
-		t->x = x;
-		t->w = taskw;
-
-		/* set icon geometry */
-		if (t->geom_x != t->x || t->geom_w != t->w) {
-			t->geom_x = t->x;
-			t->geom_w = t->w;
-
-			long icon_geometry[4] = {
-				w->panel->x + t->x,
-				w->panel->y,
-				t->w,
-				w->panel->width
-			};
-			x_set_prop_array(c, t->win, c->atoms[XATOM_NET_WM_ICON_GEOMETRY],
-					 icon_geometry, 4);
-		}
+/* damages the area occupied by the task during the last draw */
+static void damage_task(struct widget *w, struct taskbar_task *t)
+{
+	if (t->w)
+		widget_damage(w, t->x, t->w);
+	else
+		w->needs_expose = 1;
+}
 
+/* "ti" may be stale (e.g. highlighted task was removed) */
+static void damage_task_at(struct widget *w, int ti)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	if (ti >= 0 && (size_t)ti < tw->tasks_n)
+		damage_task(w, &tw->tasks[ti]);
+}
 
-		draw_task(t, tw, cr, w->panel->layout,
-			  x, taskw, t->win == tw->active, i == tw->highlighted);
-		x += taskw;
-		if (sepspace && curtask != count-1) {
-			blit_image(tw->theme.separator, cr, x, 0);
-			x += image_width(tw->theme.separator);
-		}
-		curtask++;
-	}
+static void damage_task_by_window(struct widget *w, Window win)
+{
+	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
+	damage_task_at(w, find_task_by_window(tw, win));
 }
 
 static void prop_change(struct widget *w, XPropertyEvent *e)
@@ -582,8 +816,12 @@ static void prop_change(struct widget *w, XPropertyEvent *e)
 	/* root window props */
 	if (e->window == c->root) {
 		if (e->atom == c->atoms[XATOM_NET_ACTIVE_WINDOW]) {
+			Window old = tw->active;
 			update_active(tw, c);
-			w->needs_expose = 1;
+			if (old != tw->active) {
+				damage_task_by_window(w, old);
+				damage_task_by_window(w, tw->active);
+			}
 			return;
 		}
 		if (e->atom == c->atoms[XATOM_NET_CURRENT_DESKTOP]) {
@@ -603,7 +841,9 @@ static void prop_change(struct widget *w, XPropertyEvent *e)
 	if (ti == -1) {
 		if (e->atom == c->atoms[XATOM_NET_WM_STATE] ||
 		    e->atom == c->atoms[XATOM_NET_WM_WINDOW_TYPE]) {
-			add_task(w, c, e->window);
+			struct x_window_state st = {e->window};
+			x_get_window_states(c, &st, 1);
+			add_tasks(w, c, &st, 1);
 		}
 		return;
 	}
@@ -619,6 +859,7 @@ static void prop_change(struct widget *w, XPropertyEvent *e)
 			ARRAY_PREPEND(tw->tasks, t);
 		else
 			ARRAY_INSERT_AFTER(tw->tasks, (size_t)insert_after, t);
+		reindex_tasks(tw, (size_t)MININT(ti, insert_after + 1));
 		w->needs_expose = 1;
 		return;
 	}
@@ -629,7 +870,8 @@ static void prop_change(struct widget *w, XPropertyEvent *e)
 		struct taskbar_task *t = &tw->tasks[ti];
 		x_realloc_window_name(&t->name, c, t->win,
 				      &t->name_atom, &t->name_type_atom);
-		w->needs_expose = 1;
+		invalidate_task_cache(t);
+		damage_task(w, t);
 		return;
 	}
 
@@ -641,7 +883,8 @@ static void prop_change(struct widget *w, XPropertyEvent *e)
 			struct taskbar_task *t = &tw->tasks[ti];
 			cairo_surface_destroy(t->icon);
 			t->icon = get_window_icon(c, t->win, tw->theme.default_icon);
-			w->needs_expose = 1;
+			invalidate_task_cache(t);
+			damage_task(w, t);
 			return;
 		}
 	}
@@ -649,9 +892,15 @@ static void prop_change(struct widget *w, XPropertyEvent *e)
 	if (e->atom == c->atoms[XATOM_NET_WM_STATE] ||
 	    e->atom == c->atoms[XATOM_WM_STATE]) {
 		struct taskbar_task *t = &tw->tasks[ti];
-		if (!x_is_window_visible_on_panel(c, t->win))
+		struct x_window_state st = {t->win};
+		x_get_window_states(c, &st, 1);
+		if (!st.visible_on_panel) {
 			remove_task(tw, ti);
-		t->demands_attention = x_is_window_demands_attention(c, t->win);
+			w->needs_expose = 1;
+			return;
+		}
+		t->demands_attention = st.demands_attention;
+		schedule_tick(w);
 		w->needs_expose = 1;
 		return;
 	}
@@ -832,8 +1081,9 @@ static void mouse_motion(struct widget *w, XMotionEvent *e)
 	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
 	int i = get_taskbar_task_at(w, e->x);
 	if (i != tw->highlighted) {
+		damage_task_at(w, tw->highlighted);
+		damage_task_at(w, i);
 		tw->highlighted = i;
-		w->needs_expose = 1;
 	}
 }
 
@@ -841,8 +1091,8 @@ static void mouse_leave(struct widget *w)
 {
 	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
 	if (tw->highlighted != -1) {
+		damage_task_at(w, tw->highlighted);
 		tw->highlighted = -1;
-		w->needs_expose = 1;
 	}
 }
 
@@ -851,13 +1101,19 @@ static void clock_tick(struct widget *w)
 	struct taskbar_widget *tw = (struct taskbar_widget*)w->private;
 	size_t i;
 	time_t seconds = time(0);
+
+	fetch_pending_tasks(w);
+
 	for (i = 0; i < tw->tasks_n; ++i) {
 		struct taskbar_task *t = &tw->tasks[i];
 		if (t->demands_attention > 0) {
-			w->needs_expose = 1;
-			t->demands_attention = 1 + (seconds % 2);
+			int blink = 1 + (seconds % 2);
+			if (t->demands_attention != blink)
+				damage_task(w, t);
+			t->demands_attention = blink;
 		}
 	}
+	schedule_tick(w);
 }
 
 static void configure(struct widget *w, XConfigureEvent *e)
@@ -876,17 +1132,16 @@ static void configure(struct widget *w, XConfigureEvent *e)
 		struct taskbar_task *t = &tw->tasks[ti];
 
 		/* figure out on which monitor task is located */
-		XWindowAttributes winattrs;
-		XGetWindowAttributes(c->dpy, e->window, &winattrs);
-
-		int x, y;
-		x_translate_coordinates(c, 0, 0, &x, &y, e->window);
-		int monitor = task_monitor(x, y, winattrs.width, winattrs.height,
+		const struct x_window_geometry *g = x_get_window_geometry(c, e->window);
+		if (!g)
+			return;
+		int monitor = task_monitor(g->x, g->y, g->w, g->h,
 					   monitors, monitors_n);
 
 		/* finally if task state is changed: redraw! */
 		if (t->monitor != monitor) {
 			t->monitor = monitor;
+			tw->layout_dirty = 1;
 			w->needs_expose = 1;
 		}
 	}
@@ -903,4 +1158,6 @@ static void reconfigure(struct widget *w)
 	const char *tvmstr = find_config_format_entry_value(&g_settings.root,
 							    "task_visible_monitors");
 	tw->task_visible_monitors = parse_task_visible_monitors(tvmstr);
+	tw->layout_dirty = 1;
+	schedule_tick(w);
 }
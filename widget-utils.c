@@ -1,7 +1,12 @@
 #include <stdio.h>
 #include <ctype.h>
+#include <limits.h>
 #include "widget-utils.h"
 
+#ifdef __SSE2__
+ #include <emmintrin.h>
+#endif
+
 /**************************************************************************
   Parsing utils
 **************************************************************************/
@@ -143,6 +148,7 @@ cairo_surface_t *parse_image_part_named(const char *name,
 int parse_triple_image(struct triple_image *tbt, struct config_format_entry *e,
 		       struct config_format_tree *tree, int required)
 {
+	memset(tbt->strips, 0, sizeof(tbt->strips));
 	tbt->center = parse_image_part_named("center", e, tree, required);
 	if (!tbt->center && required)
 		return -1;
@@ -177,6 +183,10 @@ void free_triple_image(struct triple_image *tbt)
 		cairo_surface_destroy(tbt->left);
 	if (tbt->right)
 		cairo_surface_destroy(tbt->right);
+
+	size_t i;
+	for (i = 0; i < TRIPLE_IMAGE_STRIPS && tbt->strips[i]; ++i)
+		cairo_surface_destroy(tbt->strips[i]);
 }
 
 int parse_text_info(struct text_info *out, struct config_format_entry *e)
@@ -374,6 +384,199 @@ void stretch_image(cairo_surface_t *src, cairo_t *dest,
 	cairo_restore(dest);
 }
 
+static void compose_triple_image(struct triple_image *tri, cairo_t *cr, int w)
+{
+	int leftw = image_width(tri->left);
+	int rightw = image_width(tri->right);
+	int centerw = w - leftw - rightw;
+
+	if (tri->stretched_overlap)
+		stretch_image(tri->center, cr, tri->center_offsets[0], 0,
+			      w - tri->center_offsets[0] - tri->center_offsets[1]);
+	else if (tri->stretched)
+		stretch_image(tri->center, cr, leftw + tri->center_offsets[0], 0,
+			      centerw - tri->center_offsets[0] - tri->center_offsets[1]);
+	else
+		pattern_image(tri->center, cr, leftw, 0, centerw, 1);
+
+	if (leftw) blit_image(tri->left, cr, 0, 0);
+	if (rightw) blit_image(tri->right, cr, leftw + centerw, 0);
+}
+
+/* Resampling the stretched center is expensive and buttons of the same
+ * width are drawn over and over again, so composed strips are kept per
+ * width in a tiny LRU.
+ */
+void draw_triple_image(struct triple_image *tri, cairo_t *dest,
+		       int dstx, int dsty, int w)
+{
+	cairo_surface_t *strip = 0;
+	size_t i;
+
+	for (i = 0; i < TRIPLE_IMAGE_STRIPS && tri->strips[i]; ++i) {
+		if (tri->strips_w[i] == w) {
+			strip = tri->strips[i];
+			break;
+		}
+	}
+
+	if (!strip) {
+		/* evict the least recently used one */
+		if (i == TRIPLE_IMAGE_STRIPS)
+			cairo_surface_destroy(tri->strips[--i]);
+
+		strip = cairo_surface_create_similar(cairo_get_target(dest),
+						     CAIRO_CONTENT_COLOR_ALPHA,
+						     w, image_height(tri->center));
+		ENSURE(cairo_surface_status(strip) == CAIRO_STATUS_SUCCESS,
+		       "Failed to create cairo surface");
+
+		cairo_t *cr = cairo_create(strip);
+		compose_triple_image(tri, cr, w);
+		cairo_destroy(cr);
+	}
+
+	/* move to front */
+	memmove(&tri->strips[1], &tri->strips[0], sizeof(tri->strips[0]) * i);
+	memmove(&tri->strips_w[1], &tri->strips_w[0], sizeof(tri->strips_w[0]) * i);
+	tri->strips[0] = strip;
+	tri->strips_w[0] = w;
+
+	blit_image(strip, dest, dstx, dsty);
+}
+
+/**************************************************************************
+  Text layout cache
+**************************************************************************/
+
+/* Shaping text is expensive and most of the strings stay the same between
+ * frames. Ready layouts are kept in a small LRU cache, keyed on everything
+ * that affects shaping. Layouts share the context of the panel layout.
+ */
+#define TEXT_CACHE_SIZE 256
+
+struct text_layout_key {
+	PangoFontDescription *font;
+	char *text;
+	int width; /* pango units, -1 for natural width */
+	PangoEllipsizeMode ellipsize;
+};
+
+struct text_layout {
+	struct text_layout_key key;
+	PangoLayout *layout;
+	PangoRectangle extents; /* logical, in pixels */
+
+	/* LRU list, head is the most recently used one */
+	struct text_layout *prev;
+	struct text_layout *next;
+};
+
+static GHashTable *text_cache;
+static struct text_layout *text_cache_head;
+static struct text_layout *text_cache_tail;
+
+static guint text_layout_key_hash(gconstpointer key)
+{
+	const struct text_layout_key *k = key;
+	return g_str_hash(k->text) ^
+		pango_font_description_hash(k->font) ^
+		((guint)k->width * 31) ^ (guint)k->ellipsize;
+}
+
+static gboolean text_layout_key_equal(gconstpointer a, gconstpointer b)
+{
+	const struct text_layout_key *ka = a;
+	const struct text_layout_key *kb = b;
+	return ka->width == kb->width &&
+		ka->ellipsize == kb->ellipsize &&
+		!strcmp(ka->text, kb->text) &&
+		pango_font_description_equal(ka->font, kb->font);
+}
+
+static void unlink_text_layout(struct text_layout *tl)
+{
+	if (tl->prev)
+		tl->prev->next = tl->next;
+	else
+		text_cache_head = tl->next;
+	if (tl->next)
+		tl->next->prev = tl->prev;
+	else
+		text_cache_tail = tl->prev;
+	tl->prev = tl->next = 0;
+}
+
+static void link_text_layout(struct text_layout *tl)
+{
+	tl->prev = 0;
+	tl->next = text_cache_head;
+	if (text_cache_head)
+		text_cache_head->prev = tl;
+	text_cache_head = tl;
+	if (!text_cache_tail)
+		text_cache_tail = tl;
+}
+
+static void free_text_layout(struct text_layout *tl)
+{
+	g_hash_table_remove(text_cache, &tl->key);
+	unlink_text_layout(tl);
+	g_object_unref(tl->layout);
+	pango_font_description_free(tl->key.font);
+	xfree(tl->key.text);
+	xfree(tl);
+}
+
+static struct text_layout *get_text_layout(PangoLayout *base,
+		PangoFontDescription *font, const char *text, int width,
+		PangoEllipsizeMode ellipsize)
+{
+	struct text_layout_key key = {font, (char*)text, width, ellipsize};
+	struct text_layout *tl;
+
+	if (!text_cache)
+		text_cache = g_hash_table_new(text_layout_key_hash,
+					      text_layout_key_equal);
+
+	tl = g_hash_table_lookup(text_cache, &key);
+	if (tl) {
+		unlink_text_layout(tl);
+		link_text_layout(tl);
+		return tl;
+	}
+
+	if (g_hash_table_size(text_cache) >= TEXT_CACHE_SIZE)
+		free_text_layout(text_cache_tail);
+
+	tl = xmallocz(sizeof(struct text_layout));
+	tl->key.font = pango_font_description_copy(font);
+	tl->key.text = xstrdup(text);
+	tl->key.width = width;
+	tl->key.ellipsize = ellipsize;
+
+	tl->layout = pango_layout_new(pango_layout_get_context(base));
+	pango_layout_set_font_description(tl->layout, font);
+	pango_layout_set_text(tl->layout, text, -1);
+	pango_layout_set_width(tl->layout, width);
+	pango_layout_set_ellipsize(tl->layout, ellipsize);
+	pango_layout_get_pixel_extents(tl->layout, 0, &tl->extents);
+
+	g_hash_table_insert(text_cache, &tl->key, tl);
+	link_text_layout(tl);
+	return tl;
+}
+
+void clean_text_cache()
+{
+	while (text_cache_head)
+		free_text_layout(text_cache_head);
+	if (text_cache) {
+		g_hash_table_destroy(text_cache);
+		text_cache = 0;
+	}
+}
+
 void draw_text(cairo_t *cr, PangoLayout *dest, struct text_info *ti,
 	       const char *text, int x, int y, int w, int h, int ellipsized)
 {
@@ -383,7 +586,7 @@ void draw_text(cairo_t *cr, PangoLayout *dest, struct text_info *ti,
 		PANGO_ELLIPSIZE_START
 	};
 
-	PangoRectangle r;
+	struct text_layout *tl;
 	int offsetx = 0, offsety = 0;
 
 	cairo_save(cr);
@@ -391,11 +594,9 @@ void draw_text(cairo_t *cr, PangoLayout *dest, struct text_info *ti,
 			(double)ti->color[0] / 255.0,
 			(double)ti->color[1] / 255.0,
 			(double)ti->color[2] / 255.0);
-	pango_layout_set_font_description(dest, ti->pfd);
-	pango_layout_set_text(dest, text, -1);
-	pango_layout_set_width(dest, -1);
+	tl = get_text_layout(dest, ti->pfd, text, -1, PANGO_ELLIPSIZE_NONE);
 
-	pango_layout_get_pixel_extents(dest, 0, &r);
+	PangoRectangle r = tl->extents;
 
 	offsety = (h - r.height) / 2;
 	switch (ti->align) {
@@ -422,10 +623,11 @@ void draw_text(cairo_t *cr, PangoLayout *dest, struct text_info *ti,
 	cairo_translate(cr, offsetx, offsety);
 	cairo_clip(cr);
 	if (ellipsized) {
-		pango_layout_set_ellipsize(dest, ellipsize_table[ti->align]);
-		pango_layout_set_width(dest, (w - offsetx) * PANGO_SCALE);
+		tl = get_text_layout(dest, ti->pfd, text,
+				     (w - offsetx) * PANGO_SCALE,
+				     ellipsize_table[ti->align]);
 	}
-	pango_cairo_update_layout(cr, dest);
+	pango_cairo_update_layout(cr, tl->layout);
 
 	if (ti->shadow_offset[0] != 0 || ti->shadow_offset[1] != 0) {
 		cairo_save(cr);
@@ -434,26 +636,23 @@ void draw_text(cairo_t *cr, PangoLayout *dest, struct text_info *ti,
 				(double)ti->shadow_color[0] / 255.0,
 				(double)ti->shadow_color[1] / 255.0,
 				(double)ti->shadow_color[2] / 255.0);
-		pango_cairo_show_layout(cr, dest);
+		pango_cairo_show_layout(cr, tl->layout);
 		cairo_restore(cr);
 	}
 
-	pango_cairo_show_layout(cr, dest);
+	pango_cairo_show_layout(cr, tl->layout);
 	cairo_restore(cr);
 }
 
 void text_extents(PangoLayout *layout, PangoFontDescription *font,
 		const char *text, int *w, int *h)
 {
-	PangoRectangle r;
-	pango_layout_set_font_description(layout, font);
-	pango_layout_set_text(layout, text, -1);
-	pango_layout_set_width(layout, -1);
-	pango_layout_get_pixel_extents(layout, 0, &r);
+	struct text_layout *tl = get_text_layout(layout, font, text, -1,
+						 PANGO_ELLIPSIZE_NONE);
 	if (w)
-		*w = r.width;
+		*w = tl->extents.width;
 	if (h)
-		*h = r.height;
+		*h = tl->extents.height;
 }
 
 void draw_rectangle_outline(cairo_t *cr, unsigned char *color, struct rect *r)
@@ -567,11 +766,80 @@ static void free_custom_surface_data(void *ptr)
 	free_static_buf(ptr);
 }
 
+/* x * a / 255, rounded */
+static inline uint32_t premultiply_channel(uint32_t x, uint32_t a)
+{
+	uint32_t t = x * a + 128;
+	return (t + (t >> 8)) >> 8;
+}
+
+static inline uint32_t premultiply_pixel(uint32_t pixel)
+{
+	uint32_t a = pixel >> 24;
+	return (a << 24) |
+		(premultiply_channel((pixel >> 16) & 0xFF, a) << 16) |
+		(premultiply_channel((pixel >> 8) & 0xFF, a) << 8) |
+		premultiply_channel(pixel & 0xFF, a);
+}
+
+#ifdef __SSE2__
+/* premultiplies 4 pixels at once, same math as premultiply_pixel */
+static inline __m128i premultiply_pixels_sse2(__m128i px)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi16(128);
+	/* alpha channel is multiplied by 255, so it stays the same */
+	const __m128i amask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+	const __m128i a255 = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+
+	__m128i lo = _mm_unpacklo_epi8(px, zero);
+	__m128i hi = _mm_unpackhi_epi8(px, zero);
+
+	__m128i alo = _mm_shufflelo_epi16(lo, _MM_SHUFFLE(3,3,3,3));
+	alo = _mm_shufflehi_epi16(alo, _MM_SHUFFLE(3,3,3,3));
+	alo = _mm_or_si128(_mm_andnot_si128(amask, alo), a255);
+	__m128i ahi = _mm_shufflelo_epi16(hi, _MM_SHUFFLE(3,3,3,3));
+	ahi = _mm_shufflehi_epi16(ahi, _MM_SHUFFLE(3,3,3,3));
+	ahi = _mm_or_si128(_mm_andnot_si128(amask, ahi), a255);
+
+	lo = _mm_add_epi16(_mm_mullo_epi16(lo, alo), round);
+	lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+	hi = _mm_add_epi16(_mm_mullo_epi16(hi, ahi), round);
+	hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+	return _mm_packus_epi16(lo, hi);
+}
+#endif
+
+/* converts netwm icon pixels (one long per pixel) to premultiplied ARGB32 */
+static void netwm_to_argb32(uint32_t *dst, const long *src, size_t n)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	for (; i + 4 <= n; i += 4) {
+		__m128i px;
+ #if LONG_MAX > 0x7fffffffL
+		/* take low halves of 64-bit longs */
+		__m128i l0 = _mm_loadu_si128((const __m128i*)&src[i]);
+		__m128i l1 = _mm_loadu_si128((const __m128i*)&src[i + 2]);
+		l0 = _mm_shuffle_epi32(l0, _MM_SHUFFLE(3,3,2,0));
+		l1 = _mm_shuffle_epi32(l1, _MM_SHUFFLE(3,3,2,0));
+		px = _mm_unpacklo_epi64(l0, l1);
+ #else
+		px = _mm_loadu_si128((const __m128i*)&src[i]);
+ #endif
+		_mm_storeu_si128((__m128i*)&dst[i], premultiply_pixels_sse2(px));
+	}
+#endif
+	for (; i < n; ++i)
+		dst[i] = premultiply_pixel((uint32_t)src[i]);
+}
+
 static cairo_surface_t *get_icon_from_netwm(long *data)
 {
 	cairo_surface_t *ret = 0;
 	uint32_t *array = 0;
-	uint32_t w,h,size,i;
+	uint32_t w,h,size;
 	long *locdata = data;
 
 	w = *locdata++;
@@ -581,19 +849,7 @@ static cairo_surface_t *get_icon_from_netwm(long *data)
 	/* convert netwm icon format to cairo data */
 	/* array = xmalloc(sizeof(uint32_t) * size); */
 	array = get_static_buf_or_xalloc(sizeof(uint32_t) * size);
-	for (i = 0; i < size; ++i) {
-		unsigned char *a, *d;
-		a = (unsigned char*)&array[i];
-		d = (unsigned char*)&locdata[i];
-		a[0] = d[0];
-		a[1] = d[1];
-		a[2] = d[2];
-		a[3] = d[3];
-		/* premultiply alpha */
-		a[0] *= (float)d[3] / 255.0f;
-		a[1] *= (float)d[3] / 255.0f;
-		a[2] *= (float)d[3] / 255.0f;
-	}
+	netwm_to_argb32(array, locdata, size);
 
 	int stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, w);
 	ret = cairo_image_surface_create_for_data((unsigned char*)array,
@@ -668,19 +924,199 @@ static cairo_surface_t *get_icon_from_pixmap(struct x_connection *c,
 	return ret;
 }
 
+/**************************************************************************
+  Icon cache
+**************************************************************************/
+
+/* Resized netwm icons are shared between windows with identical icon data
+ * (e.g. many terminals). Key is a hash of raw data, so the cache is
+ * content addressed, 64 bits of FNV-1a make collisions practically
+ * impossible. Cache doesn't own the surfaces, entry is removed when
+ * surface is destroyed by the last user.
+ */
+struct icon_key {
+	uint64_t hash;
+	int w, h;		/* source size */
+	int tw, th;		/* target size */
+};
+
+static GHashTable *icon_cache;
+static cairo_user_data_key_t icon_cache_key;
+
+static guint icon_key_hash(gconstpointer key)
+{
+	const struct icon_key *k = key;
+	return (guint)(k->hash ^ (k->hash >> 32)) ^ (k->tw << 16) ^ k->th;
+}
+
+static gboolean icon_key_equal(gconstpointer a, gconstpointer b)
+{
+	return !memcmp(a, b, sizeof(struct icon_key));
+}
+
+static void icon_key_free(gpointer key)
+{
+	xfree(key);
+}
+
+static uint64_t hash_netwm_icon(const long *data, size_t size)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	size_t i;
+	for (i = 0; i < size; ++i) {
+		uint32_t pixel = (uint32_t)data[i];
+		int j;
+		for (j = 0; j < 4; ++j) {
+			hash ^= (pixel >> (j * 8)) & 0xFF;
+			hash *= 1099511628211ULL;
+		}
+	}
+	return hash;
+}
+
+static void forget_cached_icon(void *key)
+{
+	g_hash_table_remove(icon_cache, key);
+	if (!g_hash_table_size(icon_cache)) {
+		g_hash_table_destroy(icon_cache);
+		icon_cache = 0;
+	}
+}
+
+static cairo_surface_t *lookup_cached_icon(const struct icon_key *key)
+{
+	if (!icon_cache)
+		return 0;
+
+	cairo_surface_t *icon = g_hash_table_lookup(icon_cache, key);
+	if (icon)
+		cairo_surface_reference(icon);
+	return icon;
+}
+
+static void add_cached_icon(const struct icon_key *key, cairo_surface_t *icon)
+{
+	if (!icon_cache)
+		icon_cache = g_hash_table_new_full(icon_key_hash, icon_key_equal,
+						   icon_key_free, 0);
+
+	struct icon_key *k = xmalloc(sizeof(struct icon_key));
+	*k = *key;
+	g_hash_table_insert(icon_cache, k, icon);
+
+	cairo_status_t st;
+	st = cairo_surface_set_user_data(icon, &icon_cache_key, k,
+					 forget_cached_icon);
+	ENSURE(st == CAIRO_STATUS_SUCCESS,
+	       "Failed to set user data for surface");
+}
+
+/* returns resized netwm icon, shared if possible, or 0 if data is broken */
+static cairo_surface_t *get_cached_netwm_icon(long *data, int num, int tw, int th)
+{
+	if (num < 2)
+		return 0;
+
+	struct icon_key key;
+	CLEAR_STRUCT(&key);
+	key.w = (uint32_t)data[0];
+	key.h = (uint32_t)data[1];
+	key.tw = tw;
+	key.th = th;
+	if (key.w <= 0 || key.h <= 0 || (num - 2) / key.w < key.h)
+		return 0;
+
+	key.hash = hash_netwm_icon(data + 2, (size_t)key.w * key.h);
+
+	cairo_surface_t *ret = lookup_cached_icon(&key);
+	if (ret)
+		return ret;
+
+	cairo_surface_t *icon = get_icon_from_netwm(data);
+	ret = copy_resized(icon, tw, th);
+	cairo_surface_destroy(icon);
+
+	add_cached_icon(&key, ret);
+	return ret;
+}
+
+/* Size preference: the smallest icon which is not smaller than target,
+ * if there are no such icons, the biggest one.
+ */
+static int better_icon_size(long w, long h, long bestw, long besth,
+			    int tw, int th)
+{
+	int fits = w >= tw && h >= th;
+	int bestfits = bestw >= tw && besth >= th;
+
+	if (!bestw)
+		return 1;
+	if (fits != bestfits)
+		return fits;
+	if (fits)
+		return w * h < bestw * besth;
+	return w * h > bestw * besth;
+}
+
+/* _NET_WM_ICON may contain a lot of icons of different sizes, walk through
+ * their headers and fetch only the best one
+ */
+static long *get_best_netwm_icon(struct x_connection *c, Window win,
+				 int tw, int th, int *num)
+{
+	Atom prop = c->atoms[XATOM_NET_WM_ICON];
+	long offset = 0;
+	long best_offset = -1;
+	long bestw = 0, besth = 0;
+
+	for (;;) {
+		int items = 0;
+		unsigned long after = 0;
+		long *header = x_get_prop_data_range(c, win, prop, XA_CARDINAL,
+						     offset, 2, &items, &after);
+		if (!header)
+			break;
+
+		long w = header[0];
+		long h = header[1];
+		XFree(header);
+
+		/* broken data */
+		if (items < 2 || w <= 0 || h <= 0 || (after / 4) / w < h)
+			break;
+
+		if (better_icon_size(w, h, bestw, besth, tw, th)) {
+			bestw = w;
+			besth = h;
+			best_offset = offset;
+		}
+
+		if (after / 4 == (unsigned long)(w * h))
+			break;
+		offset += 2 + w * h;
+	}
+
+	if (best_offset == -1)
+		return 0;
+
+	return x_get_prop_data_range(c, win, prop, XA_CARDINAL, best_offset,
+				     2 + bestw * besth, num, 0);
+}
+
 cairo_surface_t *get_window_icon(struct x_connection *c, Window win,
 		cairo_surface_t *default_icon)
 {
 	cairo_surface_t *ret = 0;
+	int w = image_width(default_icon);
+	int h = image_height(default_icon);
 
 	int num = 0;
-	long *data = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_ICON],
-			XA_CARDINAL, &num);
-
-	/* TODO: look for best sized icon? */
+	long *data = get_best_netwm_icon(c, win, w, h, &num);
 	if (data) {
-		ret = get_icon_from_netwm(data);
+		ret = get_cached_netwm_icon(data, num, w, h);
 		XFree(data);
+		if (ret)
+			return ret;
 	}
 
 	if (!ret) {
@@ -699,9 +1135,6 @@ cairo_surface_t *get_window_icon(struct x_connection *c, Window win,
 		return default_icon;
 	}
 
-	int w = image_width(default_icon);
-	int h = image_height(default_icon);
-
 	cairo_surface_t *sizedret = copy_resized(ret, w, h);
 	cairo_surface_destroy(ret);
 
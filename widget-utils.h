@@ -6,6 +6,8 @@
   Parsing utils
 **************************************************************************/
 
+#define TRIPLE_IMAGE_STRIPS 4
+
 struct triple_image {
 	cairo_surface_t *left;
 	cairo_surface_t *center;
@@ -13,6 +15,12 @@ struct triple_image {
 	int stretched;
 	int stretched_overlap;
 	int center_offsets[2];
+
+	/* composed strips of recently drawn widths, most recent first (see
+	 * draw_triple_image)
+	 */
+	cairo_surface_t *strips[TRIPLE_IMAGE_STRIPS];
+	int strips_w[TRIPLE_IMAGE_STRIPS];
 };
 
 #define ALIGN_CENTER 0
@@ -106,11 +114,16 @@ void stretch_image(cairo_surface_t *src, cairo_t *dest,
 		   int dstx, int dsty, int w);
 void pattern_image(cairo_surface_t *src, cairo_t *dest,
 		   int dstx, int dsty, int w, int align);
+/* left, center and right parts of "tri" as one "w" wide strip */
+void draw_triple_image(struct triple_image *tri, cairo_t *dest,
+		       int dstx, int dsty, int w);
 
 void draw_text(cairo_t *cr, PangoLayout *dest, struct text_info *ti,
 	       const char *text, int x, int y, int w, int h, int ellipsized);
 void text_extents(PangoLayout *layout, PangoFontDescription *font,
 		  const char *text, int *w, int *h);
+/* releases cached text layouts, call before freeing panel layout */
+void clean_text_cache();
 
 void draw_rectangle_outline(cairo_t *cr, unsigned char *color, struct rect *r);
 void fill_rectangle(cairo_t *cr, unsigned char *color, struct rect *r);
@@ -1,5 +1,10 @@
 #include "xutil.h"
 
+#ifdef HAVE_XSHM
+ #include <sys/ipc.h>
+ #include <sys/shm.h>
+#endif
+
 /**************************************************************************
   X error handlers
 **************************************************************************/
@@ -22,6 +27,9 @@ static int X_io_error_handler(Display *dpy)
 
 static char *atom_names[] = {
 	"WM_STATE",
+	"WM_HINTS",
+	"WM_ICON_NAME",
+	"WM_NAME",
 	"_NET_DESKTOP_NAMES",
 	"_NET_WM_STATE",
 	"_NET_ACTIVE_WINDOW",
@@ -60,8 +68,9 @@ static char *atom_names[] = {
 	"XdndStatus"
 };
 
-void *x_get_prop_data(struct x_connection *c, Window win, Atom prop,
-		      Atom type, int *items)
+void *x_get_prop_data_range(struct x_connection *c, Window win, Atom prop,
+			    Atom type, long offset, long length, int *items,
+			    unsigned long *after)
 {
 	Atom type_ret;
 	int format_ret;
@@ -70,12 +79,15 @@ void *x_get_prop_data(struct x_connection *c, Window win, Atom prop,
 	unsigned char *prop_data;
 
 	prop_data = 0;
+	items_ret = after_ret = 0;
 
-	XGetWindowProperty(c->dpy, win, prop, 0, 0x7fffffff, False,
+	XGetWindowProperty(c->dpy, win, prop, offset, length, False,
 			type, &type_ret, &format_ret, &items_ret,
 			&after_ret, &prop_data);
 	if (items)
 		*items = items_ret;
+	if (after)
+		*after = after_ret;
 	if (type != type_ret) {
 		if (prop_data)
 			XFree(prop_data);
@@ -85,6 +97,13 @@ void *x_get_prop_data(struct x_connection *c, Window win, Atom prop,
 	return prop_data;
 }
 
+void *x_get_prop_data(struct x_connection *c, Window win, Atom prop,
+		      Atom type, int *items)
+{
+	return x_get_prop_data_range(c, win, prop, type, 0, 0x7fffffff,
+				     items, 0);
+}
+
 int x_get_prop_int(struct x_connection *c, Window win, Atom at)
 {
 	int num = 0;
@@ -129,6 +148,105 @@ int x_get_window_desktop(struct x_connection *c, Window win)
 	return x_get_prop_int(c, win, c->atoms[XATOM_NET_WM_DESKTOP]);
 }
 
+/**************************************************************************
+  Batched property requests
+**************************************************************************/
+
+#ifdef HAVE_XCB
+/* converts reply to the Xlib layout: format 32 items are longs, data is
+ * always terminated by an extra zero item
+ */
+static void *convert_prop_reply(xcb_get_property_reply_t *r)
+{
+	int n = (int)r->value_len;
+	void *value = xcb_get_property_value(r);
+	void *data;
+	int i;
+
+	switch (r->format) {
+	case 8:
+		data = xmalloc(n + 1);
+		memcpy(data, value, n);
+		((char*)data)[n] = 0;
+		break;
+	case 16:
+		data = xmalloc(sizeof(short) * (n + 1));
+		for (i = 0; i < n; ++i)
+			((short*)data)[i] = ((int16_t*)value)[i];
+		((short*)data)[n] = 0;
+		break;
+	case 32:
+		/* Xlib sign extends these too */
+		data = xmalloc(sizeof(long) * (n + 1));
+		for (i = 0; i < n; ++i)
+			((long*)data)[i] = ((int32_t*)value)[i];
+		((long*)data)[n] = 0;
+		break;
+	default:
+		data = 0;
+		break;
+	}
+	return data;
+}
+#endif
+
+void x_get_props(struct x_connection *c, struct x_prop_request *reqs, size_t n)
+{
+	size_t i;
+#ifdef HAVE_XCB
+	/* send everything first.. */
+	for (i = 0; i < n; ++i) {
+		struct x_prop_request *r = &reqs[i];
+		r->cookie = xcb_get_property(c->xcb, 0, r->win, r->prop, r->type,
+					     0, 0x7fffffff).sequence;
+	}
+
+	/* ..then wait for replies, errors (e.g. BadWindow) are not reported
+	 * to Xlib error handler, request simply has no data
+	 */
+	for (i = 0; i < n; ++i) {
+		struct x_prop_request *r = &reqs[i];
+		xcb_get_property_cookie_t cookie = {r->cookie};
+		xcb_generic_error_t *err = 0;
+		xcb_get_property_reply_t *reply;
+
+		r->data = 0;
+		r->items = 0;
+		reply = xcb_get_property_reply(c->xcb, cookie, &err);
+		if (err)
+			free(err);
+		if (!reply)
+			continue;
+
+		r->items = reply->value_len;
+		if (reply->type == r->type)
+			r->data = convert_prop_reply(reply);
+		free(reply);
+	}
+#else
+	for (i = 0; i < n; ++i) {
+		struct x_prop_request *r = &reqs[i];
+		r->data = x_get_prop_data(c, r->win, r->prop, r->type,
+					  &r->items);
+	}
+#endif
+}
+
+void x_free_props(struct x_prop_request *reqs, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; ++i) {
+		if (!reqs[i].data)
+			continue;
+#ifdef HAVE_XCB
+		xfree(reqs[i].data);
+#else
+		XFree(reqs[i].data);
+#endif
+		reqs[i].data = 0;
+	}
+}
+
 /**************************************************************************
   multiheads setup
 **************************************************************************/
@@ -221,6 +339,21 @@ static int init_xinerama(struct x_connection *c)
 #endif
 }
 
+/**************************************************************************
+  ARGB visual
+**************************************************************************/
+
+static void init_argb_visual(struct x_connection *c)
+{
+	XVisualInfo vinfo;
+	if (!XMatchVisualInfo(c->dpy, c->screen, 32, TrueColor, &vinfo))
+		return;
+
+	c->argb_visual = vinfo.visual;
+	c->argb_colormap = XCreateColormap(c->dpy, c->root, vinfo.visual,
+					   AllocNone);
+}
+
 static void init_monitors(struct x_connection *c)
 {
 	int opcode, event, error;
@@ -237,6 +370,125 @@ static void init_monitors(struct x_connection *c)
 	*c->monitors = (struct x_monitor){0,0,c->screen_width,c->screen_height};
 }
 
+/**************************************************************************
+  Window geometry tracker
+**************************************************************************/
+
+static void free_geometry(gpointer data)
+{
+	xfree(data);
+}
+
+static void fetch_frame_extents(struct x_connection *c, Window win,
+				struct x_window_geometry *g)
+{
+	int n;
+	long *extents = x_get_prop_data(c, win, c->atoms[XATOM_NET_FRAME_EXTENTS],
+					XA_CARDINAL, &n);
+	memset(g->frame, 0, sizeof(g->frame));
+	if (extents) {
+		if (n == 4)
+			memcpy(g->frame, extents, sizeof(g->frame));
+		XFree(extents);
+	}
+}
+
+/* the slow path, used when a window starts to be tracked or events can't
+ * tell where it is
+ */
+static void resync_position(struct x_connection *c, Window win,
+			    struct x_window_geometry *g)
+{
+	Window child;
+	XTranslateCoordinates(c->dpy, win, c->root, 0, 0, &g->x, &g->y, &child);
+}
+
+const struct x_window_geometry *x_track_window(struct x_connection *c,
+					       Window win)
+{
+	struct x_window_geometry *g = g_hash_table_lookup(c->geometries,
+							  GUINT_TO_POINTER(win));
+	if (g)
+		return g;
+
+	/* Window could be gone already, its DestroyNotify was handled (or
+	 * will be ignored), an entry would never be removed and its XID
+	 * could be reused.
+	 */
+	static const struct x_window_geometry gone;
+	XWindowAttributes winattrs;
+	if (!XGetWindowAttributes(c->dpy, win, &winattrs))
+		return &gone;
+
+	g = xmallocz(sizeof(struct x_window_geometry));
+	g->w = winattrs.width;
+	g->h = winattrs.height;
+	resync_position(c, win, g);
+	fetch_frame_extents(c, win, g);
+
+	Window root, *children = 0;
+	unsigned int children_n;
+	if (XQueryTree(c->dpy, win, &root, &g->parent, &children, &children_n)) {
+		if (children)
+			XFree(children);
+	} else {
+		g->parent = c->root;
+	}
+
+	g_hash_table_insert(c->geometries, GUINT_TO_POINTER(win), g);
+	return g;
+}
+
+const struct x_window_geometry *x_get_window_geometry(struct x_connection *c,
+						      Window win)
+{
+	return g_hash_table_lookup(c->geometries, GUINT_TO_POINTER(win));
+}
+
+/* Synthetic events (sent by WM, see ICCCM 4.1.5) and events of windows which
+ * are not reparented carry root coordinates. Real events of reparented
+ * windows are relative to the frame, only size can be trusted there.
+ */
+void x_geometry_configure(struct x_connection *c, XConfigureEvent *e)
+{
+	struct x_window_geometry *g = g_hash_table_lookup(c->geometries,
+							  GUINT_TO_POINTER(e->window));
+	if (!g)
+		return;
+
+	g->w = e->width;
+	g->h = e->height;
+	if (e->send_event || g->parent == c->root) {
+		g->x = e->x;
+		g->y = e->y;
+	} else
+		resync_position(c, e->window, g);
+}
+
+void x_geometry_reparent(struct x_connection *c, XReparentEvent *e)
+{
+	struct x_window_geometry *g = g_hash_table_lookup(c->geometries,
+							  GUINT_TO_POINTER(e->window));
+	if (!g)
+		return;
+
+	g->parent = e->parent;
+	resync_position(c, e->window, g);
+}
+
+void x_geometry_frame_extents(struct x_connection *c, Window win)
+{
+	struct x_window_geometry *g = g_hash_table_lookup(c->geometries,
+							  GUINT_TO_POINTER(win));
+	if (g)
+		fetch_frame_extents(c, win, g);
+}
+
+void x_untrack_window(struct x_connection *c, Window win)
+{
+	g_hash_table_remove(c->geometries, GUINT_TO_POINTER(win));
+}
+
 /**************************************************************************
   *the* interface
 **************************************************************************/
@@ -264,15 +516,22 @@ void x_connect(struct x_connection *c, const char *display)
 	c->default_colormap	= DefaultColormap(c->dpy, c->screen);
 	c->default_depth	= DefaultDepth(c->dpy, c->screen);
 	c->root			= RootWindow(c->dpy, c->screen);
+#ifdef HAVE_XCB
+	c->xcb			= XGetXCBConnection(c->dpy);
+#endif
 	x_update_root_pmap(c);
 
 	XSelectInput(c->dpy, c->root, PropertyChangeMask | StructureNotifyMask);
 
 	init_monitors(c);
+	init_argb_visual(c);
+	c->geometries = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					      0, free_geometry);
 }
 
 void x_disconnect(struct x_connection *c)
 {
+	g_hash_table_destroy(c->geometries);
 	xfree(c->monitors);
 	if (c->argb_visual)
 		XFreeColormap(c->dpy, c->argb_colormap);
@@ -317,6 +576,43 @@ Window x_create_default_embedder(struct x_connection *c, Window parent,
 			     c->default_visual, CWBackPixmap, &attrs);
 }
 
+Window x_create_argb_window(struct x_connection *c, int x, int y,
+		unsigned int w, unsigned int h, unsigned long valuemask,
+		XSetWindowAttributes *attrs)
+{
+	attrs->colormap = c->argb_colormap;
+	attrs->border_pixel = 0;
+	return XCreateWindow(c->dpy, c->root, x, y, w, h, 0,
+			     32, InputOutput, c->argb_visual,
+			     valuemask | CWColormap | CWBorderPixel, attrs);
+}
+
+Pixmap x_create_argb_pixmap(struct x_connection *c, unsigned int w,
+		unsigned int h)
+{
+	return XCreatePixmap(c->dpy, c->root, w, h, 32);
+}
+
+Window x_create_argb_embedder(struct x_connection *c, Window parent,
+			      Window icon, unsigned int w, unsigned int h)
+{
+	XSetWindowAttributes attrs;
+	attrs.background_pixmap = ParentRelative;
+	attrs.colormap = c->argb_colormap;
+	attrs.border_pixel = 0;
+	return XCreateWindow(c->dpy, parent, 0, 0, w, h, 0,
+			     32, InputOutput, c->argb_visual,
+			     CWBackPixmap | CWColormap | CWBorderPixel, &attrs);
+}
+
+int x_is_composited(struct x_connection *c)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "_NET_WM_CM_S%d", c->screen);
+	Atom cm = XInternAtom(c->dpy, buf, False);
+	return XGetSelectionOwner(c->dpy, cm) != None;
+}
+
 void x_set_prop_int(struct x_connection *c, Window win, Atom type, int value)
 {
 	XChangeProperty(c->dpy, win, type, XA_CARDINAL, 32,
@@ -343,236 +639,279 @@ void x_set_prop_array(struct x_connection *c, Window win, Atom type,
 			PropModeReplace, (unsigned char*)values, len);
 }
 
-int x_is_window_visible_on_panel(struct x_connection *c, Window win)
-{
-	Atom *data;
-	int ret = 1;
-	int num;
+/**************************************************************************
+  Window state
+**************************************************************************/
 
-	data = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_WINDOW_TYPE],
-			XA_ATOM, &num);
-	if (data) {
-		while (num) {
-			num--;
-			if (data[num] == c->atoms[XATOM_NET_WM_WINDOW_TYPE_DOCK] ||
-			    data[num] == c->atoms[XATOM_NET_WM_WINDOW_TYPE_DESKTOP])
-			{
-				XFree(data);
-				return 0;
-			}
+enum {
+	WSTATE_WINDOW_TYPE,
+	WSTATE_WM_STATE,
+	WSTATE_NET_WM_STATE,
+	WSTATE_WM_HINTS,
+	WSTATE_NET_WM_DESKTOP,
+	WSTATE_COUNT
+};
 
-		}
-		XFree(data);
+static int has_atom(const struct x_prop_request *r, Atom at)
+{
+	const Atom *atoms = r->data;
+	int i;
+	if (!atoms)
+		return 0;
+	for (i = 0; i < r->items; ++i) {
+		if (atoms[i] == at)
+			return 1;
 	}
+	return 0;
+}
 
-	data = x_get_prop_data(c, win, c->atoms[XATOM_WM_STATE],
-			       c->atoms[XATOM_WM_STATE], 0);
-	if (data) {
-		if (data[0] == WithdrawnState) {
-			XFree(data);
-			return 0;
-		}
-		XFree(data);
-	}
+static void fill_window_state(struct x_connection *c, struct x_window_state *st,
+			      const struct x_prop_request *r)
+{
+	const long *wmstate = r[WSTATE_WM_STATE].data;
+	const long *wmhints = r[WSTATE_WM_HINTS].data;
+	const long *desktop = r[WSTATE_NET_WM_DESKTOP].data;
+	const struct x_prop_request *netstate = &r[WSTATE_NET_WM_STATE];
+
+	int hidden_type =
+		has_atom(&r[WSTATE_WINDOW_TYPE],
+			 c->atoms[XATOM_NET_WM_WINDOW_TYPE_DOCK]) ||
+		has_atom(&r[WSTATE_WINDOW_TYPE],
+			 c->atoms[XATOM_NET_WM_WINDOW_TYPE_DESKTOP]);
+	int withdrawn = wmstate && wmstate[0] == WithdrawnState;
+	int skip_taskbar = has_atom(netstate,
+				    c->atoms[XATOM_NET_WM_STATE_SKIP_TASKBAR]);
+	int hidden = has_atom(netstate, c->atoms[XATOM_NET_WM_STATE_HIDDEN]);
+
+	st->visible_on_panel = !hidden_type && !withdrawn && !skip_taskbar;
+	st->visible_on_screen = st->visible_on_panel && !hidden;
+	st->iconified = (wmstate && wmstate[0] == IconicState) || hidden;
+	st->demands_attention =
+		(wmhints && (wmhints[0] & XUrgencyHint)) ||
+		has_atom(netstate, c->atoms[XATOM_NET_WM_STATE_DEMANDS_ATTENTION]);
+	st->desktop = desktop ? (int)desktop[0] : 0;
+}
 
-	data = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_STATE], XA_ATOM, &num);
-	if (!data)
-		return 1;
+void x_get_window_states(struct x_connection *c, struct x_window_state *states,
+			 size_t n)
+{
+	struct x_prop_request *reqs;
+	size_t i;
+
+	if (!n)
+		return;
 
-	while (num) {
-		num--;
-		if (data[num] == c->atoms[XATOM_NET_WM_STATE_SKIP_TASKBAR])
-			ret = 0;
+	reqs = xmallocz(sizeof(struct x_prop_request) * WSTATE_COUNT * n);
+	for (i = 0; i < n; ++i) {
+		struct x_prop_request *r = &reqs[i * WSTATE_COUNT];
+		Window win = states[i].win;
+
+		r[WSTATE_WINDOW_TYPE] = (struct x_prop_request){win,
+			c->atoms[XATOM_NET_WM_WINDOW_TYPE], XA_ATOM};
+		r[WSTATE_WM_STATE] = (struct x_prop_request){win,
+			c->atoms[XATOM_WM_STATE], c->atoms[XATOM_WM_STATE]};
+		r[WSTATE_NET_WM_STATE] = (struct x_prop_request){win,
+			c->atoms[XATOM_NET_WM_STATE], XA_ATOM};
+		r[WSTATE_WM_HINTS] = (struct x_prop_request){win,
+			XA_WM_HINTS, XA_WM_HINTS};
+		r[WSTATE_NET_WM_DESKTOP] = (struct x_prop_request){win,
+			c->atoms[XATOM_NET_WM_DESKTOP], XA_CARDINAL};
 	}
-	XFree(data);
 
-	return ret;
+	x_get_props(c, reqs, WSTATE_COUNT * n);
+	for (i = 0; i < n; ++i)
+		fill_window_state(c, &states[i], &reqs[i * WSTATE_COUNT]);
+
+	x_free_props(reqs, WSTATE_COUNT * n);
+	xfree(reqs);
 }
 
-int x_is_window_visible_on_screen(struct x_connection *c, Window win)
+static void get_window_state(struct x_connection *c, Window win,
+			     struct x_window_state *st)
 {
-	Atom *data;
-	int ret = 1;
-	int num;
+	st->win = win;
+	x_get_window_states(c, st, 1);
+}
 
-	data = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_WINDOW_TYPE],
-			XA_ATOM, &num);
-	if (data) {
-		while (num) {
-			num--;
-			if (data[num] == c->atoms[XATOM_NET_WM_WINDOW_TYPE_DOCK] ||
-			    data[num] == c->atoms[XATOM_NET_WM_WINDOW_TYPE_DESKTOP])
-			{
-				XFree(data);
-				return 0;
-			}
+int x_is_window_visible_on_panel(struct x_connection *c, Window win)
+{
+	struct x_window_state st;
+	get_window_state(c, win, &st);
+	return st.visible_on_panel;
+}
 
-		}
-		XFree(data);
-	}
+int x_is_window_visible_on_screen(struct x_connection *c, Window win)
+{
+	struct x_window_state st;
+	get_window_state(c, win, &st);
+	return st.visible_on_screen;
+}
 
-	data = x_get_prop_data(c, win, c->atoms[XATOM_WM_STATE],
-			       c->atoms[XATOM_WM_STATE], 0);
-	if (data) {
-		if (data[0] == WithdrawnState) {
-			XFree(data);
-			return 0;
-		}
-		XFree(data);
-	}
+int x_is_window_demands_attention(struct x_connection *c, Window win)
+{
+	struct x_window_state st;
+	get_window_state(c, win, &st);
+	return st.demands_attention;
+}
 
-	data = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_STATE], XA_ATOM, &num);
-	if (!data)
-		return 1;
+int x_is_window_iconified(struct x_connection *c, Window win)
+{
+	struct x_window_state st;
+	get_window_state(c, win, &st);
+	return st.iconified;
+}
 
-	while (num) {
-		num--;
-		if (data[num] == c->atoms[XATOM_NET_WM_STATE_SKIP_TASKBAR] ||
-		    data[num] == c->atoms[XATOM_NET_WM_STATE_HIDDEN])
-			ret = 0;
-	}
-	XFree(data);
+/* window name sources in order of preference: property and its type, the
+ * taskbar routes changes of these (window_props in widget-taskbar.c)
+ */
+#define WNAME_COUNT 8
 
-	return ret;
+static void get_name_sources(struct x_connection *c, Atom sources[][2])
+{
+	Atom utf8 = c->atoms[XATOM_UTF8_STRING];
+	const Atom s[WNAME_COUNT][2] = {
+		{c->atoms[XATOM_NET_WM_VISIBLE_ICON_NAME], utf8},
+		{c->atoms[XATOM_NET_WM_ICON_NAME], utf8},
+		{XA_WM_ICON_NAME, XA_STRING},
+		{XA_WM_ICON_NAME, utf8},
+		{c->atoms[XATOM_NET_WM_VISIBLE_NAME], utf8},
+		{c->atoms[XATOM_NET_WM_NAME], utf8},
+		{XA_WM_NAME, XA_STRING},
+		{XA_WM_NAME, utf8}
+	};
+	memcpy(sources, s, sizeof(s));
 }
 
-int x_is_window_demands_attention(struct x_connection *c, Window win)
+static void set_window_name(struct x_window_name *wn, const char *name,
+			    Atom atom, Atom type)
 {
-	Atom *data;
-	int ret = 0;
-	int num;
+	wn->atom = atom;
+	wn->type = type;
+	strbuf_assign(wn->name, name);
+}
 
-	XWMHints *wmh = XGetWMHints(c->dpy, win);
-	if (wmh) {
-		if (wmh->flags & XUrgencyHint) {
-			XFree(wmh);
-			return 1;
+#ifdef HAVE_XCB
+/* Probes all sources of all windows at once without downloading values
+ * (zero length requests tell the type of a property), "found" receives
+ * the index of the first source with a matching type or -1.
+ */
+static void find_name_sources(struct x_connection *c,
+			      struct x_window_name *names, size_t n,
+			      Atom sources[][2], int *found)
+{
+	xcb_get_property_cookie_t *cookies;
+	size_t i, j;
+
+	cookies = xmalloc(sizeof(xcb_get_property_cookie_t) * WNAME_COUNT * n);
+	for (i = 0; i < n; ++i) {
+		for (j = 0; j < WNAME_COUNT; ++j) {
+			cookies[i * WNAME_COUNT + j] = xcb_get_property(c->xcb,
+				0, names[i].win, sources[j][0], sources[j][1],
+				0, 0);
 		}
-		XFree(wmh);
 	}
 
-	data = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_STATE], XA_ATOM, &num);
-	if (!data)
-		return 0;
-
-	while (num) {
-		num--;
-		if (data[num] == c->atoms[XATOM_NET_WM_STATE_DEMANDS_ATTENTION])
-			ret = 1;
+	for (i = 0; i < n; ++i) {
+		found[i] = -1;
+		for (j = 0; j < WNAME_COUNT; ++j) {
+			xcb_generic_error_t *err = 0;
+			xcb_get_property_reply_t *reply;
+
+			reply = xcb_get_property_reply(c->xcb,
+					cookies[i * WNAME_COUNT + j], &err);
+			if (err)
+				free(err);
+			if (!reply)
+				continue;
+			if (found[i] == -1 && reply->type == sources[j][1])
+				found[i] = (int)j;
+			free(reply);
+		}
 	}
-	XFree(data);
-
-	return ret;
+	xfree(cookies);
 }
+#endif
 
-int x_is_window_iconified(struct x_connection *c, Window win)
+void x_get_window_names(struct x_connection *c, struct x_window_name *names,
+			size_t n)
 {
-	unsigned long *data;
-	int ret = 0;
+	Atom sources[WNAME_COUNT][2];
+	size_t i;
 
-	data = x_get_prop_data(c, win, c->atoms[XATOM_WM_STATE],
-			       c->atoms[XATOM_WM_STATE], 0);
-	if (data) {
-		if (data[0] == IconicState) {
-			ret = 1;
-		}
-		XFree(data);
+	if (!n)
+		return;
+
+	get_name_sources(c, sources);
+#ifdef HAVE_XCB
+	/* one round trip to find the sources, one to fetch the names */
+	int *found = xmalloc(sizeof(int) * n);
+	struct x_prop_request *reqs = xmallocz(sizeof(struct x_prop_request) * n);
+	size_t reqs_n = 0;
+	find_name_sources(c, names, n, sources, found);
+
+	for (i = 0; i < n; ++i) {
+		if (found[i] == -1)
+			continue;
+		reqs[reqs_n].win = names[i].win;
+		reqs[reqs_n].prop = sources[found[i]][0];
+		reqs[reqs_n].type = sources[found[i]][1];
+		reqs_n++;
+	}
+	x_get_props(c, reqs, reqs_n);
+
+	size_t k = 0;
+	for (i = 0; i < n; ++i) {
+		set_window_name(&names[i], "<unknown>", None, None);
+		if (found[i] == -1)
+			continue;
+
+		/* property could be removed in between */
+		struct x_prop_request *r = &reqs[k++];
+		if (r->data)
+			set_window_name(&names[i], r->data, r->prop, r->type);
 	}
 
-	int num;
-	data = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_STATE], XA_ATOM, &num);
-	if (data) {
-		while (num) {
-			num--;
-			if (data[num] == c->atoms[XATOM_NET_WM_STATE_HIDDEN])
-				ret = 1;
+	x_free_props(reqs, reqs_n);
+	xfree(reqs);
+	xfree(found);
+#else
+	/* replies aren't pipelined, stop at the first name found */
+	for (i = 0; i < n; ++i) {
+		struct x_window_name *wn = &names[i];
+		size_t j;
+
+		set_window_name(wn, "<unknown>", None, None);
+		for (j = 0; j < WNAME_COUNT; ++j) {
+			char *name = x_get_prop_data(c, wn->win, sources[j][0],
+						     sources[j][1], 0);
+			if (name) {
+				set_window_name(wn, name, sources[j][0],
+						sources[j][1]);
+				XFree(name);
+				break;
+			}
 		}
-		XFree(data);
 	}
-
-	return ret;
+#endif
 }
 
 void x_realloc_window_name(struct strbuf *sb, struct x_connection *c,
 			   Window win, Atom *atom, Atom *atype)
 {
-	char *name = 0;
 	if (*atom != None) {
 		/* fast path */
-		name = x_get_prop_data(c, win, *atom, *atype, 0);
-		if (name)
-			goto name_here;
-	}
-	/****************/
-	*atype = c->atoms[XATOM_UTF8_STRING];
-	*atom = c->atoms[XATOM_NET_WM_VISIBLE_ICON_NAME];
-
-	name = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_VISIBLE_ICON_NAME],
-			c->atoms[XATOM_UTF8_STRING], 0);
-	if (name)
-		goto name_here;
-	/****************/
-	*atype = c->atoms[XATOM_UTF8_STRING];
-	*atom = c->atoms[XATOM_NET_WM_ICON_NAME];
-
-	name = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_ICON_NAME],
-			c->atoms[XATOM_UTF8_STRING], 0);
-	if (name)
-		goto name_here;
-	/****************/
-	*atype = XA_STRING;
-	*atom = XA_WM_ICON_NAME;
-
-	name = x_get_prop_data(c, win, XA_WM_ICON_NAME, XA_STRING, 0);
-	if (name)
-		goto name_here;
-	/****************/
-	*atype = c->atoms[XATOM_UTF8_STRING];
-	*atom = XA_WM_ICON_NAME;
-
-	name = x_get_prop_data(c, win, XA_WM_ICON_NAME, c->atoms[XATOM_UTF8_STRING], 0);
-	if (name)
-		goto name_here;
-	/****************/
-	*atype = c->atoms[XATOM_UTF8_STRING];
-	*atom = c->atoms[XATOM_NET_WM_VISIBLE_NAME];
-
-	name = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_VISIBLE_NAME],
-			c->atoms[XATOM_UTF8_STRING], 0);
-	if (name)
-		goto name_here;
-	/****************/
-	*atype = c->atoms[XATOM_UTF8_STRING];
-	*atom = c->atoms[XATOM_NET_WM_NAME];
-
-	name = x_get_prop_data(c, win, c->atoms[XATOM_NET_WM_NAME],
-			c->atoms[XATOM_UTF8_STRING], 0);
-	if (name)
-		goto name_here;
-	/****************/
-	*atype = XA_STRING;
-	*atom = XA_WM_NAME;
-
-	name = x_get_prop_data(c, win, XA_WM_NAME, XA_STRING, 0);
-	if (name)
-		goto name_here;
-	/****************/
-	*atype = c->atoms[XATOM_UTF8_STRING];
-	*atom = XA_WM_NAME;
-
-	name = x_get_prop_data(c, win, XA_WM_NAME, c->atoms[XATOM_UTF8_STRING], 0);
-	if (name)
-		goto name_here;
-	else {
-		*atom = None;
-		*atype = None;
-		strbuf_assign(sb, "<unknown>");
-		return;
+		char *name = x_get_prop_data(c, win, *atom, *atype, 0);
+		if (name) {
+			strbuf_assign(sb, name);
+			XFree(name);
+			return;
+		}
 	}
-	/****************/
-name_here:
-	strbuf_assign(sb, name);
-	XFree(name);
+
+	struct x_window_name wn = {win, sb};
+	x_get_window_names(c, &wn, 1);
+	*atom = wn.atom;
+	*atype = wn.type;
 }
 
 void x_send_netwm_message(struct x_connection *c, Window win,
@@ -619,6 +958,90 @@ void x_translate_coordinates(struct x_connection *c, int x, int y,
 	XTranslateCoordinates(c->dpy, win, c->root, x, y, xout, yout, &tmpwin);
 }
 
+/**************************************************************************
+  MIT-SHM images
+**************************************************************************/
+
+struct x_shm_image *x_create_shm_image(struct x_connection *c, Visual *visual,
+				       int depth, int w, int h)
+{
+#ifdef HAVE_XSHM
+	if (!XShmQueryExtension(c->dpy))
+		return 0;
+
+	struct x_shm_image *shm = xmallocz(sizeof(struct x_shm_image));
+	shm->dpy = c->dpy;
+	shm->info.shmid = -1;
+	shm->image = XShmCreateImage(c->dpy, visual, depth, ZPixmap, 0,
+				     &shm->info, w, h);
+	if (!shm->image)
+		goto fail;
+
+	/* pixels are written by cairo, so layout should be a native one */
+	const uint32_t one = 1;
+	int native_order = *(const char*)&one ? LSBFirst : MSBFirst;
+	if (shm->image->bits_per_pixel != 32 ||
+	    shm->image->byte_order != native_order)
+		goto fail;
+
+	shm->info.shmid = shmget(IPC_PRIVATE,
+				 shm->image->bytes_per_line * shm->image->height,
+				 IPC_CREAT | 0600);
+	if (shm->info.shmid == -1)
+		goto fail;
+
+	shm->info.shmaddr = shm->image->data = shmat(shm->info.shmid, 0, 0);
+	if (shm->info.shmaddr == (char*)-1)
+		goto fail;
+	shm->info.readOnly = False;
+
+	/* attaching fails on remote connections */
+	x_set_error_trap();
+	XShmAttach(c->dpy, &shm->info);
+	XSync(c->dpy, False);
+	if (x_done_error_trap()) {
+		shmdt(shm->info.shmaddr);
+		goto fail;
+	}
+
+	/* segment will be destroyed after both sides detach */
+	shmctl(shm->info.shmid, IPC_RMID, 0);
+	return shm;
+
+fail:
+	if (shm->info.shmid != -1)
+		shmctl(shm->info.shmid, IPC_RMID, 0);
+	if (shm->image) {
+		shm->image->data = 0;
+		XDestroyImage(shm->image);
+	}
+	xfree(shm);
+	return 0;
+#else
+	return 0;
+#endif
+}
+
+void x_destroy_shm_image(struct x_shm_image *shm)
+{
+#ifdef HAVE_XSHM
+	XShmDetach(shm->dpy, &shm->info);
+	XSync(shm->dpy, False);
+	shmdt(shm->info.shmaddr);
+	shm->image->data = 0;
+	XDestroyImage(shm->image);
+	xfree(shm);
+#endif
+}
+
+void x_put_shm_image(struct x_shm_image *shm, Drawable d, GC gc,
+		     int x, int y, unsigned int w, unsigned int h)
+{
+#ifdef HAVE_XSHM
+	XShmPutImage(shm->dpy, d, gc, shm->image, x, y, x, y, w, h, False);
+#endif
+}
+
 /**************************************************************************
   X error trap
 **************************************************************************/
@@ -5,6 +5,7 @@
 #include <X11/Xutil.h>
 #include <X11/cursorfont.h>
 #include <X11/extensions/shape.h>
+#include <glib.h>
 #include "config.h"
 #include "util.h"
 
@@ -16,8 +17,19 @@
  #include <X11/extensions/Xrandr.h>
 #endif
 
+#ifdef HAVE_XCB
+ #include <X11/Xlib-xcb.h>
+#endif
+
+#ifdef HAVE_XSHM
+ #include <X11/extensions/XShm.h>
+#endif
+
 enum x_atom {
 	XATOM_WM_STATE,
+	XATOM_WM_HINTS,
+	XATOM_WM_ICON_NAME,
+	XATOM_WM_NAME,
 	XATOM_NET_DESKTOP_NAMES,
 	XATOM_NET_WM_STATE,
 	XATOM_NET_ACTIVE_WINDOW,
@@ -67,6 +79,9 @@ struct x_monitor {
 
 struct x_connection {
 	Display *dpy;
+#ifdef HAVE_XCB
+	xcb_connection_t *xcb; /* owned by Xlib */
+#endif
 
 	int screen;
 	int screen_width;
@@ -79,13 +94,15 @@ struct x_connection {
 	Colormap default_colormap;
 	int default_depth;
 
-	Visual *argb_visual;
+	Visual *argb_visual; /* 0 if there is no 32 bit visual */
 	Colormap argb_colormap;
 
 	Window root;
 	Pixmap root_pixmap;
 
 	Atom atoms[XATOM_COUNT];
+
+	GHashTable *geometries; /* Window -> struct x_window_geometry */
 };
 
 void x_connect(struct x_connection *c, const char *display);
@@ -115,10 +132,55 @@ Pixmap x_create_default_pixmap(struct x_connection *c,
 Window x_create_default_embedder(struct x_connection *c, Window parent,
 				 Window icon, unsigned int w, unsigned int h);
 
+/*
+ * Same as default ones, but with depth = 32 and visual = c->argb_visual
+ * (check that it exists first). Colormap and border pixel are set in
+ * "attrs", so it can't be null.
+ */
+Window x_create_argb_window(struct x_connection *c,
+			    int x, int y, unsigned int w, unsigned int h,
+			    unsigned long valuemask, XSetWindowAttributes *attrs);
+Pixmap x_create_argb_pixmap(struct x_connection *c,
+			    unsigned int w, unsigned int h);
+Window x_create_argb_embedder(struct x_connection *c, Window parent,
+			      Window icon, unsigned int w, unsigned int h);
+
+/* is there a compositing manager (owner of _NET_WM_CM_Sn selection) */
+int x_is_composited(struct x_connection *c);
+
 /* allocated by Xlib, should be released with XFree */
 void *x_get_prop_data(struct x_connection *c, Window win, Atom prop,
 		      Atom type, int *items);
 
+/*
+ * Reads "length" 32-bit units starting from "offset" (also in 32-bit
+ * units), "after" receives amount of bytes left after the read part.
+ */
+void *x_get_prop_data_range(struct x_connection *c, Window win, Atom prop,
+			    Atom type, long offset, long length, int *items,
+			    unsigned long *after);
+
+/*
+ * Batched version of x_get_prop_data. All requests are sent at once and
+ * replies are collected afterwards, so the whole batch costs one round
+ * trip (with XCB, otherwise it's just a loop). Fill "win", "prop" and
+ * "type", results are in "data" and "items". Data should be released
+ * with "x_free_props".
+ */
+struct x_prop_request {
+	Window win;
+	Atom prop;
+	Atom type;
+
+	void *data;
+	int items;
+
+	unsigned int cookie; /* private */
+};
+
+void x_get_props(struct x_connection *c, struct x_prop_request *reqs, size_t n);
+void x_free_props(struct x_prop_request *reqs, size_t n);
+
 int x_get_prop_int(struct x_connection *c, Window win, Atom at);
 Window x_get_prop_window(struct x_connection *c, Window win, Atom at);
 Pixmap x_get_prop_pixmap(struct x_connection *c, Window win, Atom at);
@@ -131,14 +193,74 @@ void x_set_prop_atom(struct x_connection *c, Window win, Atom type, Atom at);
 void x_set_prop_array(struct x_connection *c, Window win, Atom type,
 		      const long *values, size_t len);
 
+/* window state for several windows at once (fill "win" fields) */
+struct x_window_state {
+	Window win;
+	int visible_on_panel;
+	int visible_on_screen;
+	int iconified;
+	int demands_attention;
+	int desktop;
+};
+
+void x_get_window_states(struct x_connection *c, struct x_window_state *states,
+			 size_t n);
+
 int x_is_window_visible_on_panel(struct x_connection *c, Window win);
 int x_is_window_visible_on_screen(struct x_connection *c, Window win);
 int x_is_window_iconified(struct x_connection *c, Window win);
 int x_is_window_demands_attention(struct x_connection *c, Window win);
 
+/*
+ * Task name of a window, "atom" and "type" tell which property it came
+ * from (None if there is no name). Several windows at once (fill "win" and
+ * "name" fields). With XCB the whole batch costs two round trips and only
+ * the chosen names are downloaded, otherwise sources are tried one by one
+ * for each window until a name is found.
+ */
+struct x_window_name {
+	Window win;
+	struct strbuf *name;
+	Atom atom;
+	Atom type;
+};
+
+void x_get_window_names(struct x_connection *c, struct x_window_name *names,
+			size_t n);
+
+/* "atom" and "atype" is the last known source, tried first */
 void x_realloc_window_name(struct strbuf *sb, struct x_connection *c,
 			   Window win, Atom *atom, Atom *atype);
 
+/*
+ * Window geometry tracker. Geometry of tracked windows is kept up to date
+ * from ConfigureNotify, ReparentNotify and _NET_FRAME_EXTENTS changes (fed
+ * by the panel), so readers don't need round trips. Window should have
+ * StructureNotifyMask and PropertyChangeMask selected. Tracking stops when
+ * the window is destroyed.
+ */
+struct x_window_geometry {
+	int x; /* client window in root coordinates */
+	int y;
+	int w;
+	int h;
+	long frame[4]; /* _NET_FRAME_EXTENTS: left, right, top, bottom */
+	Window parent;
+};
+
+/* starts tracking (if not yet), the first call fetches the geometry, a
+ * window which doesn't exist isn't tracked and has zero geometry
+ */
+const struct x_window_geometry *x_track_window(struct x_connection *c,
+					       Window win);
+/* null if "win" isn't tracked */
+const struct x_window_geometry *x_get_window_geometry(struct x_connection *c,
+						      Window win);
+void x_geometry_configure(struct x_connection *c, XConfigureEvent *e);
+void x_geometry_reparent(struct x_connection *c, XReparentEvent *e);
+void x_geometry_frame_extents(struct x_connection *c, Window win);
+void x_untrack_window(struct x_connection *c, Window win);
+
 void x_send_netwm_message(struct x_connection *c, Window win,
 			  Atom a, long l0, long l1, long l2, long l3, long l4);
 void x_send_dnd_message(struct x_connection *c, Window win,
@@ -147,5 +269,24 @@ void x_update_root_pmap(struct x_connection *c);
 void x_translate_coordinates(struct x_connection *c, int x, int y,
 			     int *xout, int *yout, Window win);
 
+/*
+ * MIT-SHM image, pixels are shared with X server and uploaded without a
+ * copy through the socket. Creation fails (returns 0) if the extension
+ * is missing or the connection is not local.
+ */
+struct x_shm_image {
+	Display *dpy;
+	XImage *image;
+#ifdef HAVE_XSHM
+	XShmSegmentInfo info;
+#endif
+};
+
+struct x_shm_image *x_create_shm_image(struct x_connection *c, Visual *visual,
+				       int depth, int w, int h);
+void x_destroy_shm_image(struct x_shm_image *shm);
+void x_put_shm_image(struct x_shm_image *shm, Drawable d, GC gc,
+		     int x, int y, unsigned int w, unsigned int h);
+
 void x_set_error_trap();
 int x_done_error_trap();